@@ -0,0 +1,275 @@
+#include <blogger/blogger.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <new>
+
+// -------- Allocation counting
+
+static std::atomic<size_t> g_allocations(0);
+
+void* operator new(size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+
+    if (void* ptr = std::malloc(size ? size : 1))
+        return ptr;
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+// -------- A sink that only counts what it receives
+
+class counting_sink : public bl::sink
+{
+public:
+    static std::atomic<size_t>& written()
+    {
+        static std::atomic<size_t> s_written(0);
+        return s_written;
+    }
+
+    // Calls to write or write_batch
+    static std::atomic<size_t>& calls()
+    {
+        static std::atomic<size_t> s_calls(0);
+        return s_calls;
+    }
+
+    void write(bl::log_message& msg) override
+    {
+        calls().fetch_add(1, std::memory_order_relaxed);
+
+        // Touch the message so it isn't optimized away
+        if (msg.size() && msg.data()[0])
+            written().fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void write_batch(bl::log_message* const* messages, size_t count) override
+    {
+        calls().fetch_add(1, std::memory_order_relaxed);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (messages[i]->size() && messages[i]->data()[0])
+                written().fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void flush() override
+    {
+    }
+};
+
+constexpr size_t message_count = 200000;
+
+// Stays below the message slots of an async logger so nothing gets dropped
+constexpr size_t batch_size = 512;
+
+void log_request(bl::logger& logger, size_t id)
+{
+    logger.info(
+        "Request {} from {} finished with status {} in {}ms",
+        id, "192.168.100.42", "OK", 12.5
+    );
+}
+
+// Whether the steady state got by without allocating
+bool run(const char* name, bl::logging_mode mode)
+{
+    auto logger = bl::logger::make_custom(
+        "Benchmark",
+        bl::level::trace,
+        bl::logger::default_pattern,
+        mode,
+        bl::sink::ptr(new counting_sink())
+    );
+
+    counting_sink::written() = 0;
+
+    // Warm up thread locals and format caches with the
+    // same call, only the steady state is measured
+    for (size_t i = 0; i < batch_size; ++i)
+        log_request(*logger, i);
+
+    logger->flush();
+
+    while (counting_sink::written().load() < batch_size)
+        std::this_thread::yield();
+
+    counting_sink::written() = 0;
+    counting_sink::calls() = 0;
+    size_t allocations_before = g_allocations.load();
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // Time spent inside the log calls only
+    std::chrono::nanoseconds caller(0);
+
+    for (size_t logged = 0; logged < message_count; logged += batch_size)
+    {
+        auto batch_start = std::chrono::high_resolution_clock::now();
+
+        for (size_t i = 0; i < batch_size; ++i)
+            log_request(*logger, logged + i);
+
+        logger->flush();
+
+        caller += std::chrono::high_resolution_clock::now() - batch_start;
+
+        while (counting_sink::written().load() < logged + batch_size)
+            std::this_thread::yield();
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    size_t allocations = g_allocations.load() - allocations_before;
+
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+    std::cout << name << ": "
+              << static_cast<double>(ns) / message_count << "ns/message, "
+              << static_cast<double>(caller.count()) / message_count << "ns/message on the caller, "
+              << static_cast<double>(allocations) / message_count << " allocations/message, "
+              << static_cast<double>(message_count) / counting_sink::calls().load() << " messages/sink call\n";
+
+    if (allocations)
+        std::cout << name << ": logging allocated in the steady state\n";
+
+    return allocations == 0;
+}
+
+// -------- Raw queue throughput, many producers and one consumer
+
+// What thread_pool used to queue tasks with
+class locked_deque
+{
+private:
+    std::deque<size_t> m_queue;
+    std::mutex         m_access;
+    size_t             m_capacity;
+public:
+    locked_deque(size_t capacity)
+        : m_capacity(capacity)
+    {
+    }
+
+    bool try_push(size_t& value)
+    {
+        bl::locker lock(m_access);
+
+        if (m_queue.size() == m_capacity)
+            return false;
+
+        m_queue.push_back(value);
+        return true;
+    }
+
+    bool try_pop(size_t& out)
+    {
+        bl::locker lock(m_access);
+
+        if (m_queue.empty())
+            return false;
+
+        out = m_queue.front();
+        m_queue.pop_front();
+        return true;
+    }
+};
+
+constexpr size_t queue_items = 1 << 20;
+
+template<typename Queue>
+double queue_throughput(size_t producer_count)
+{
+    Queue queue(16384);
+    std::vector<std::thread> producers;
+
+    size_t per_producer = queue_items / producer_count;
+    size_t total = per_producer * producer_count;
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    for (size_t i = 0; i < producer_count; ++i)
+    {
+        producers.emplace_back([&queue, per_producer]()
+        {
+            for (size_t item = 0; item < per_producer; ++item)
+            {
+                while (!queue.try_push(item))
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    size_t item;
+    for (size_t consumed = 0; consumed < total;)
+    {
+        if (queue.try_pop(item))
+            ++consumed;
+        else
+            std::this_thread::yield();
+    }
+
+    for (auto& producer : producers)
+        producer.join();
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto seconds = std::chrono::duration<double>(end - start).count();
+
+    return total / seconds / 1000000.0;
+}
+
+constexpr size_t queue_runs = 5;
+
+// Runs alternate between the two so that neither gets
+// a quieter machine, the median of each is reported
+void compare_queues()
+{
+    std::cout << "Queue throughput (million items/s, median of " << queue_runs
+              << " runs), producers: mutex+deque / ring_buffer\n";
+
+    for (size_t producers = 1; producers <= 64; producers *= 2)
+    {
+        std::vector<double> baseline, ring;
+
+        for (size_t run = 0; run < queue_runs; ++run)
+        {
+            baseline.push_back(queue_throughput<locked_deque>(producers));
+            ring.push_back(queue_throughput<bl::ring_buffer<size_t>>(producers));
+        }
+
+        std::sort(baseline.begin(), baseline.end());
+        std::sort(ring.begin(), ring.end());
+
+        std::cout << "  " << producers << ": "
+                  << baseline[queue_runs / 2] << " / "
+                  << ring[queue_runs / 2] << "\n";
+    }
+}
+
+int main()
+{
+    bool allocation_free = true;
+
+    allocation_free &= run("BlockingLogger", bl::logging_mode::blocking);
+    allocation_free &= run("AsyncLogger", bl::logging_mode::async);
+    allocation_free &= run("PerThreadAsyncLogger", bl::logging_mode::async_per_thread);
+    allocation_free &= run("OrderedAsyncLogger", bl::logging_mode::async_ordered);
+
+    compare_queues();
+
+    return allocation_free ? 0 : 1;
+}
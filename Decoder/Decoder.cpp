@@ -0,0 +1,369 @@
+#include <blogger/blogger.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Turns files written by bl::binary_sink back into text.
+//
+//     blogger-decode [--json] <file>
+//
+// By default every message is rendered with the pattern of the logger
+// that wrote it, --json prints one JSON object per line instead.
+// Has to be built in the same (unicode or not) mode as the writer.
+
+class reader
+{
+private:
+    std::vector<char> m_data;
+    size_t            m_pos = 0;
+public:
+    bool load(const char* path)
+    {
+        auto* file = std::fopen(path, "rb");
+
+        if (!file)
+            return false;
+
+        char chunk[1 << 16];
+        size_t read;
+
+        while ((read = std::fread(chunk, 1, sizeof(chunk), file)) > 0)
+            m_data.insert(m_data.end(), chunk, chunk + read);
+
+        std::fclose(file);
+
+        return true;
+    }
+
+    bool done() const
+    {
+        return m_pos == m_data.size();
+    }
+
+    template<typename T>
+    bool read(T& value)
+    {
+        if (m_data.size() - m_pos < sizeof(T))
+            return false;
+
+        std::memcpy(&value, m_data.data() + m_pos, sizeof(T));
+        m_pos += sizeof(T);
+
+        return true;
+    }
+
+    bool read_bytes(void* out, size_t size)
+    {
+        if (m_data.size() - m_pos < size)
+            return false;
+
+        std::memcpy(out, m_data.data() + m_pos, size);
+        m_pos += size;
+
+        return true;
+    }
+
+    bool read_chars(bl::message_buffer& out)
+    {
+        uint32_t size;
+
+        if (!read(size))
+            return false;
+
+        out.resize(size);
+
+        return read_bytes(out.data(), size * sizeof(bl::char_t));
+    }
+
+    bool read_chars(bl::string& out)
+    {
+        static bl::message_buffer chars;
+
+        if (!read_chars(chars))
+            return false;
+
+        out.assign(chars.data(), chars.size());
+
+        return true;
+    }
+};
+
+// Along with the formatter settings it was written with
+struct pattern_entry
+{
+    std::unique_ptr<bl::log_pattern> pattern;
+    bl::string                       ending;
+    uint64_t                         max_length = 0;
+    bl::string                       postfix;
+};
+
+// Wide characters are taken as code points
+void append_utf8(std::string& out, unsigned long code_point)
+{
+    if (code_point < 0x800)
+    {
+        out += static_cast<char>(0xC0 | (code_point >> 6));
+    }
+    else if (code_point < 0x10000)
+    {
+        out += static_cast<char>(0xE0 | (code_point >> 12));
+        out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+    }
+    else
+    {
+        out += static_cast<char>(0xF0 | ((code_point >> 18) & 0x07));
+        out += static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+    }
+
+    out += static_cast<char>(0x80 | (code_point & 0x3F));
+}
+
+void append_json_string(std::string& out, const bl::char_t* chars, size_t size)
+{
+    out += '"';
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        auto c = chars[i];
+
+        switch (c)
+        {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n";  break;
+            case '\r': out += "\\r";  break;
+            case '\t': out += "\\t";  break;
+            default:
+                if (static_cast<unsigned long>(c) < 0x20)
+                {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+                    out += escaped;
+                }
+                else if (sizeof(bl::char_t) == 1 || static_cast<unsigned long>(c) < 0x80)
+                    out += static_cast<char>(c);
+                else
+                    append_utf8(out, static_cast<unsigned long>(c));
+        }
+    }
+
+    out += '"';
+}
+
+int main(int argc, char** argv)
+{
+    bool json = false;
+    const char* path = nullptr;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--json") == 0)
+            json = true;
+        else
+            path = argv[i];
+    }
+
+    if (!path)
+    {
+        std::fprintf(stderr, "usage: %s [--json] <file>\n", argv[0]);
+        return 1;
+    }
+
+  #ifdef BLOGGER_UNICODE_MODE
+    bl::init_unicode();
+  #endif
+
+    reader in;
+
+    if (!in.load(path))
+    {
+        std::fprintf(stderr, "couldn't open %s\n", path);
+        return 1;
+    }
+
+    char magic[8];
+    uint8_t version;
+    uint8_t char_size;
+
+    if (!in.read_bytes(magic, sizeof(magic)) ||
+        std::memcmp(magic, bl::binary_sink::magic(), sizeof(magic)) != 0 ||
+        !in.read(version) || !in.read(char_size))
+    {
+        std::fprintf(stderr, "%s is not a BLogger binary log\n", path);
+        return 1;
+    }
+
+    if (version != bl::binary_sink::version)
+    {
+        std::fprintf(stderr, "unsupported version %u\n", static_cast<unsigned>(version));
+        return 1;
+    }
+
+    if (char_size != sizeof(bl::char_t))
+    {
+        std::fprintf(stderr, "written with %u byte characters, rebuild the decoder %s unicode mode\n",
+                     static_cast<unsigned>(char_size),
+                     char_size > 1 ? "in" : "without");
+        return 1;
+    }
+
+    const bl::level::type levels[] = {
+        bl::level::trace,
+        bl::level::debug,
+        bl::level::info,
+        bl::level::warn,
+        bl::level::error,
+        bl::level::crit
+    };
+
+    std::vector<bl::string>    formats;
+    std::vector<pattern_entry> patterns;
+
+    // Whose formatter settings are in effect
+    const uint32_t no_pattern = static_cast<uint32_t>(-1);
+    uint32_t       applied = no_pattern;
+
+    bl::message_buffer payload;
+    bl::message_buffer text;
+    bl::message_buffer rendered;
+    std::string        line;
+
+    while (!in.done())
+    {
+        using kind = bl::binary_sink::record_kind;
+
+        uint8_t record;
+        uint32_t id;
+
+        if (!in.read(record))
+            break;
+
+        switch (static_cast<kind>(record))
+        {
+            case kind::format:
+            {
+                bl::string format;
+
+                if (!in.read(id) || !in.read_chars(format))
+                    goto truncated;
+
+                if (formats.size() <= id)
+                    formats.resize(id + 1);
+
+                formats[id] = format;
+                break;
+            }
+            case kind::pattern:
+            {
+                bl::string tag, source;
+                pattern_entry entry;
+
+                if (!in.read(id) || !in.read_chars(tag) || !in.read_chars(source) ||
+                    !in.read_chars(entry.ending) || !in.read(entry.max_length) || !in.read_chars(entry.postfix))
+                    goto truncated;
+
+                if (patterns.size() <= id)
+                    patterns.resize(id + 1);
+
+                entry.pattern.reset(new bl::log_pattern(source, tag));
+                patterns[id] = std::move(entry);
+
+                // Whatever was applied for this id is stale now
+                if (applied == id)
+                    applied = no_pattern;
+                break;
+            }
+            case kind::timestamp:
+            {
+                bl::string format;
+
+                if (!in.read_chars(format))
+                    goto truncated;
+
+                bl::formatter::set_timestamp_format(format);
+                break;
+            }
+            case kind::message:
+            {
+                uint32_t format_id, pattern_id;
+                int64_t  time;
+                uint64_t sequence;
+                uint8_t  lvl;
+
+                if (!in.read(format_id) || !in.read(pattern_id) || !in.read(time) ||
+                    !in.read(sequence) || !in.read(lvl) || !in.read_chars(payload))
+                    goto truncated;
+
+                if (format_id >= formats.size() || pattern_id >= patterns.size() ||
+                    !patterns[pattern_id].pattern || lvl >= 6)
+                {
+                    std::fprintf(stderr, "corrupted message record\n");
+                    return 1;
+                }
+
+                auto& format = formats[format_id];
+                auto& pattern = *patterns[pattern_id].pattern;
+                bl::level level = levels[lvl];
+
+                bl::deferred_reader args(payload.data(), payload.size());
+                const bl::char_t* empty;
+                size_t empty_size, arg_count;
+
+                text.clear();
+
+                if (args.read_header(empty, empty_size, arg_count))
+                    bl::deferred::format_with(text, format.data(), format.size(), args, arg_count);
+
+                if (json)
+                {
+                    line = "{\"time_ns\":";
+                    line += std::to_string(time);
+                    line += ",\"seq\":";
+                    line += std::to_string(sequence);
+                    line += ",\"level\":";
+                    append_json_string(line, level.to_string(), std::char_traits<bl::char_t>::length(level.to_string()));
+                    line += ",\"tag\":";
+                    append_json_string(line, pattern.tag().data(), pattern.tag().size());
+                    line += ",\"message\":";
+                    append_json_string(line, text.data(), text.size());
+                    line += "}\n";
+
+                    std::fwrite(line.data(), 1, line.size(), stdout);
+                }
+                else
+                {
+                    if (applied != pattern_id)
+                    {
+                        auto& entry = patterns[pattern_id];
+
+                        bl::formatter::set_ending(entry.ending);
+                        bl::formatter::cut_if_exceeds(static_cast<size_t>(entry.max_length), entry.postfix);
+
+                        applied = pattern_id;
+                    }
+
+                    bl::formatter::merge_pattern(text, pattern, time, level, sequence, rendered);
+
+                  #ifdef BLOGGER_UNICODE_MODE
+                    std::wcout.write(rendered.data(), rendered.size());
+                  #else
+                    std::fwrite(rendered.data(), 1, rendered.size(), stdout);
+                  #endif
+                }
+                break;
+            }
+            default:
+                std::fprintf(stderr, "unknown record kind %u\n", static_cast<unsigned>(record));
+                return 1;
+        }
+    }
+
+    return 0;
+
+truncated:
+    std::fprintf(stderr, "%s is truncated\n", path);
+    return 1;
+}
@@ -81,6 +81,31 @@ int main()
 
     // --------------------------------------------------
 
+
+
+  #ifdef BLOGGER_ZLIB
+    // -------- Compressing finished log files in the background
+
+    bl::file_options options;
+    options.compression = bl::codec::make_gzip();
+
+    // Every finished file becomes tag-N.log.gz
+    auto compressed_logger = bl::logger::make_async_file(
+        "Compressed",
+        bl::level::info,
+        bl::logger::default_pattern,
+        "logs",
+        1024 * 1024,  // bytes per file
+        10,           // maximum log files
+        true,         // should rotate logs?
+        options
+    );
+
+    compressed_logger->info("Rotated files are gzipped by a background thread");
+
+    // --------------------------------------------------
+  #endif
+
     // Will only shutdown after AsyncLogger
     // has finished all of its tasks
     return 0;
@@ -0,0 +1,186 @@
+#include "Check.h"
+
+#ifdef _WIN32
+    #define popen  _popen
+    #define pclose _pclose
+#endif
+
+// -------- binary_sink and blogger-decode against the text sinks
+
+// Passed in by ctest
+const char* g_decoder = nullptr;
+
+std::string decode(const std::string& path, const char* flags = "")
+{
+    std::string command = std::string("\"") + g_decoder + "\" " + flags + " \"" + path + "\"";
+    std::string text;
+
+    if (auto* pipe = popen(command.c_str(), "r"))
+    {
+        char chunk[4096];
+        size_t read;
+
+        while ((read = std::fread(chunk, 1, sizeof(chunk), pipe)) > 0)
+            text.append(chunk, read);
+
+        pclose(pipe);
+    }
+
+    return text;
+}
+
+std::string joined(const std::vector<std::string>& lines)
+{
+    std::string text;
+
+    for (auto& line : lines)
+        text += line;
+
+    return text;
+}
+
+struct point
+{
+    int x, y;
+};
+
+std::ostream& operator<<(std::ostream& stream, const point& p)
+{
+    return stream << "(" << p.x << ", " << p.y << ")";
+}
+
+namespace bl {
+    template<>
+    struct serializer<point> : trivial_serializer<point>
+    {
+    };
+}
+
+void log_everything(bl::logger& logger, captured& text)
+{
+    static const bl::format_string compiled("{1} before {0}");
+
+    logger.info("Request {} from {} took {}ms", 1, "10.0.0.1", 2.5);
+    logger.warning(compiled, 'x', -7);
+    logger.error("at {} quoted \"{}\"", point{ 3, 4 }, true);
+    logger.critical("{} {0} {}", std::string("owned"), 18446744073709551615ull);
+    logger.debug("no arguments {}");
+    text.flush(logger);
+
+    logger.set_pattern("{lvl}|{msg}|{tag}");
+    logger.trace("after the pattern changed {}", 42);
+    text.flush(logger);
+}
+
+void check_round_trip(bl::logging_mode mode, bool deferred)
+{
+    auto directory = scratch_directory("binary");
+    auto path = directory + "out.blog";
+    auto text = captured::make();
+
+    {
+        auto logger = bl::logger::make_custom(
+            "svc",
+            bl::level::trace,
+            "[{ts:us}][{lvl}][{tag}] #{seq} {msg}",
+            mode,
+            bl::sink::make_binary(path),
+            capture_sink::make(text)
+        );
+
+        logger->set_deferred_formatting(deferred);
+
+        log_everything(*logger, *text);
+    }
+
+    auto expected = joined(text->lines());
+
+    CHECK(count_lines(expected) == 6);
+    CHECK_EQ(decode(path), expected);
+}
+
+TEST(blocking_logger_round_trip)
+{
+    check_round_trip(bl::logging_mode::blocking, false);
+}
+
+TEST(ordered_logger_round_trip)
+{
+    check_round_trip(bl::logging_mode::async_ordered, false);
+}
+
+TEST(deferred_logger_round_trip)
+{
+    check_round_trip(bl::logging_mode::async_ordered, true);
+}
+
+TEST(formatter_settings_round_trip)
+{
+    auto directory = scratch_directory("binary-settings");
+    auto path = directory + "out.blog";
+    auto text = captured::make();
+
+    {
+        auto logger = bl::logger::make_custom(
+            "svc",
+            bl::level::trace,
+            "{ts}|{msg}",
+            bl::logging_mode::async_ordered,
+            bl::sink::make_binary(path),
+            capture_sink::make(text)
+        );
+
+        logger->set_deferred_formatting(true);
+
+        bl::formatter::set_ending(" <end>\n");
+        bl::formatter::cut_if_exceeds(24, "~");
+        logger->info("{} is long enough to be cut", "this message");
+        text->flush(*logger);
+
+        // Only picked up by patterns published after it
+        bl::formatter::set_ending("\n");
+        bl::formatter::cut_if_exceeds(bl::infinite);
+        logger->set_pattern("{ts}/{msg}");
+
+        bl::formatter::set_timestamp_format("%Y");
+        logger->info("{} is not cut", "this message");
+        text->flush(*logger);
+
+        bl::formatter::set_timestamp_format();
+    }
+
+    auto expected = joined(text->lines());
+
+    CHECK(count_lines(expected) == 2);
+    CHECK_EQ(decode(path), expected);
+}
+
+TEST(json_output)
+{
+    auto directory = scratch_directory("binary-json");
+    auto path = directory + "out.blog";
+
+    {
+        auto logger = bl::logger::make_custom("json", bl::level::trace, "{msg}", false, bl::sink::make_binary(path));
+
+        logger->warning("quote \" backslash \\ tab \t {}", 1);
+    }
+
+    auto json = decode(path, "--json");
+
+    CHECK(json.find("\"seq\":0,\"level\":\"WARNING\",\"tag\":\"json\",") != std::string::npos);
+    CHECK(json.find("\"message\":\"quote \\\" backslash \\\\ tab \\t 1\"}\n") != std::string::npos);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::fprintf(stderr, "usage: %s <blogger-decode>\n", argv[0]);
+        return 1;
+    }
+
+    g_decoder = argv[1];
+
+    return run_tests();
+}
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <blogger/blogger.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+
+#ifdef _WIN32
+    #include <direct.h>
+#else
+    #include <sys/stat.h>
+#endif
+
+// Just enough of a test harness for the behavior tests.
+// Every TEST in a file runs in the order it's defined in,
+// a failed CHECK reports itself and the test carries on.
+// Only built in narrow mode.
+
+struct test_case
+{
+    const char* name;
+    void      (*run)();
+};
+
+inline std::vector<test_case>& test_cases()
+{
+    static std::vector<test_case> s_cases;
+    return s_cases;
+}
+
+inline int& failed_checks()
+{
+    static int s_failed = 0;
+    return s_failed;
+}
+
+struct test_registrar
+{
+    test_registrar(const char* name, void (*run)())
+    {
+        test_cases().push_back({ name, run });
+    }
+};
+
+#define TEST(name)                                          \
+    static void name();                                     \
+    static test_registrar name##_registrar(#name, &name);   \
+    static void name()
+
+#define CHECK(condition)                                                    \
+    do                                                                      \
+    {                                                                       \
+        if (!(condition))                                                   \
+        {                                                                   \
+            ++failed_checks();                                              \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n",               \
+                         __FILE__, __LINE__, #condition);                   \
+        }                                                                   \
+    } while (0)
+
+// Both sides have to convert to std::string
+#define CHECK_EQ(actual, expected)                                          \
+    do                                                                      \
+    {                                                                       \
+        std::string actual_text(actual), expected_text(expected);           \
+                                                                            \
+        if (actual_text != expected_text)                                   \
+        {                                                                   \
+            ++failed_checks();                                              \
+            std::fprintf(stderr, "%s:%d: %s\n    got:      \"%s\"\n"        \
+                         "    expected: \"%s\"\n", __FILE__, __LINE__,      \
+                         #actual, actual_text.c_str(),                      \
+                         expected_text.c_str());                            \
+        }                                                                   \
+    } while (0)
+
+inline int run_tests()
+{
+    for (auto& test : test_cases())
+    {
+        int failed_before = failed_checks();
+
+        test.run();
+
+        std::printf("%s %s\n", failed_checks() == failed_before ? "ok  " : "FAIL", test.name);
+    }
+
+    return failed_checks() ? 1 : 0;
+}
+
+// -------- Helpers
+
+// What capture sinks have been given, outlives them. While
+// closed it holds the backend inside its first write, so that
+// nothing is given back and queue limits are hit on purpose.
+class captured
+{
+private:
+    std::vector<std::string> m_lines;
+    std::mutex               m_access;
+    std::condition_variable  m_changed;
+    size_t                   m_flushes;
+    bool                     m_open;
+    bool                     m_entered;
+public:
+    using ptr = std::shared_ptr<captured>;
+
+    static ptr make(bool open = true)
+    {
+        return std::make_shared<captured>(open);
+    }
+
+    explicit captured(bool open)
+        : m_flushes(0),
+          m_open(open),
+          m_entered(false)
+    {
+    }
+
+    void add(bl::log_message& msg)
+    {
+        std::unique_lock<std::mutex> lock(m_access);
+
+        m_entered = true;
+        m_changed.notify_all();
+        m_changed.wait(lock, [this]() { return m_open; });
+
+        m_lines.emplace_back(msg.data(), msg.size());
+    }
+
+    void flushed()
+    {
+        std::lock_guard<std::mutex> lock(m_access);
+
+        ++m_flushes;
+        m_changed.notify_all();
+    }
+
+    // Flushes the logger and waits for it to get to the sink,
+    // which is after everything the logger posted before
+    void flush(bl::logger& logger)
+    {
+        std::unique_lock<std::mutex> lock(m_access);
+        auto expected = m_flushes + 1;
+
+        lock.unlock();
+        logger.flush();
+        lock.lock();
+
+        m_changed.wait(lock, [this, expected]() { return m_flushes >= expected; });
+    }
+
+    // Until the backend is stuck in a write
+    void wait_entered()
+    {
+        std::unique_lock<std::mutex> lock(m_access);
+        m_changed.wait(lock, [this]() { return m_entered; });
+    }
+
+    void open()
+    {
+        std::lock_guard<std::mutex> lock(m_access);
+
+        m_open = true;
+        m_changed.notify_all();
+    }
+
+    std::vector<std::string> lines()
+    {
+        std::lock_guard<std::mutex> lock(m_access);
+        return m_lines;
+    }
+};
+
+class capture_sink : public bl::sink
+{
+private:
+    captured::ptr m_output;
+public:
+    static bl::sink::ptr make(captured::ptr output)
+    {
+        return bl::sink::ptr(new capture_sink(std::move(output)));
+    }
+
+    explicit capture_sink(captured::ptr output)
+        : m_output(std::move(output))
+    {
+    }
+
+    void write(bl::log_message& msg) override
+    {
+        m_output->add(msg);
+    }
+
+    void flush() override
+    {
+        m_output->flushed();
+    }
+};
+
+inline std::string read_file(const std::string& path)
+{
+    std::string text;
+
+    if (auto* file = std::fopen(path.c_str(), "rb"))
+    {
+        char chunk[4096];
+        size_t read;
+
+        while ((read = std::fread(chunk, 1, sizeof(chunk), file)) > 0)
+            text.append(chunk, read);
+
+        std::fclose(file);
+    }
+
+    return text;
+}
+
+inline size_t count_lines(const std::string& text)
+{
+    size_t lines = 0;
+
+    for (auto c : text)
+        lines += c == '\n';
+
+    return lines;
+}
+
+// An empty directory of that name under the working directory,
+// ends with a separator
+inline std::string scratch_directory(const std::string& name)
+{
+    std::string path = "blogger-test-" + name + "/";
+
+  #ifdef _WIN32
+    _mkdir(path.c_str());
+  #else
+    mkdir(path.c_str(), 0755);
+  #endif
+
+    for (auto& file : bl::list_files(path))
+        bl::remove_file(path + file.name);
+
+    return path;
+}
@@ -0,0 +1,588 @@
+#include "Check.h"
+
+#include <algorithm>
+#include <atomic>
+#include <ctime>
+#include <thread>
+
+#ifdef _WIN32
+    #include <sys/utime.h>
+    #define utime   _utime
+    #define utimbuf _utimbuf
+#else
+    #include <utime.h>
+#endif
+
+// -------- Helpers
+
+// "prefix0\n" up to "prefix<to - 1>\n"
+std::string numbered(const char* prefix, size_t from, size_t to)
+{
+    std::string text;
+
+    for (size_t i = from; i < to; ++i)
+        text += prefix + std::to_string(i) + "\n";
+
+    return text;
+}
+
+// Every line is 8 bytes, 12 of them fit into 100
+void log_lines(bl::logger& logger, size_t from, size_t to)
+{
+    for (size_t i = from; i < to; ++i)
+        logger.info("line {}", i < 10 ? "0" + std::to_string(i) : std::to_string(i));
+}
+
+std::string lines(size_t from, size_t to)
+{
+    std::string text;
+
+    for (size_t i = from; i < to; ++i)
+        text += "line " + (i < 10 ? "0" + std::to_string(i) : std::to_string(i)) + "\n";
+
+    return text;
+}
+
+std::vector<std::string> file_names(const std::string& directory)
+{
+    std::vector<std::string> names;
+
+    for (auto& file : bl::list_files(directory))
+        names.push_back(file.name);
+
+    std::sort(names.begin(), names.end());
+
+    return names;
+}
+
+std::string joined_names(const std::string& directory)
+{
+    std::string text;
+
+    for (auto& name : file_names(directory))
+        text += name + " ";
+
+    return text;
+}
+
+uint64_t total_size(const std::string& directory, const std::string& prefix)
+{
+    uint64_t total = 0;
+
+    for (auto& file : bl::list_files(directory))
+    {
+        if (file.name.compare(0, prefix.size(), prefix) == 0)
+            total += file.size;
+    }
+
+    return total;
+}
+
+void make_file(const std::string& path, const std::string& text, int64_t age_seconds = 0)
+{
+    if (auto* file = std::fopen(path.c_str(), "wb"))
+    {
+        std::fwrite(text.data(), 1, text.size(), file);
+        std::fclose(file);
+    }
+
+    if (age_seconds)
+    {
+        utimbuf times;
+        times.actime = times.modtime = std::time(nullptr) - age_seconds;
+        utime(path.c_str(), &times);
+    }
+}
+
+// Polls for up to 5 seconds, the housekeeper works in the background
+template<typename Condition>
+bool eventually(Condition&& condition)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+
+    while (!condition())
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    return true;
+}
+
+// -------- Size rotation
+
+TEST(rotates_by_size)
+{
+    auto directory = scratch_directory("size");
+
+    {
+        auto logger = bl::logger::make_file("rot", bl::level::trace, "{msg}", directory, 100, 3, true);
+        log_lines(*logger, 0, 30);
+    }
+
+    CHECK_EQ(joined_names(directory), "rot-1.log rot-2.log rot-3.log ");
+    CHECK_EQ(read_file(directory + "rot-1.log"), lines(0, 12));
+    CHECK_EQ(read_file(directory + "rot-2.log"), lines(12, 24));
+    CHECK_EQ(read_file(directory + "rot-3.log"), lines(24, 30));
+}
+
+TEST(async_rotates_by_size)
+{
+    auto directory = scratch_directory("async-size");
+
+    {
+        auto logger = bl::logger::make_async_file("rot", bl::level::trace, "{msg}", directory, 100, 3, true);
+        log_lines(*logger, 0, 30);
+    }
+
+    CHECK_EQ(joined_names(directory), "rot-1.log rot-2.log rot-3.log ");
+    CHECK_EQ(read_file(directory + "rot-1.log") + read_file(directory + "rot-2.log") + read_file(directory + "rot-3.log"), lines(0, 30));
+}
+
+TEST(wraps_around_to_the_first_file)
+{
+    auto directory = scratch_directory("wrap");
+
+    {
+        auto logger = bl::logger::make_file("rot", bl::level::trace, "{msg}", directory, 100, 2, true);
+        log_lines(*logger, 0, 30);
+    }
+
+    CHECK_EQ(joined_names(directory), "rot-1.log rot-2.log ");
+    CHECK_EQ(read_file(directory + "rot-1.log"), lines(24, 30));
+    CHECK_EQ(read_file(directory + "rot-2.log"), lines(12, 24));
+}
+
+TEST(stops_at_the_last_file_without_rotation)
+{
+    auto directory = scratch_directory("no-rotation");
+
+    {
+        auto logger = bl::logger::make_file("rot", bl::level::trace, "{msg}", directory, 100, 2, false);
+        log_lines(*logger, 0, 30);
+    }
+
+    CHECK_EQ(joined_names(directory), "rot-1.log rot-2.log ");
+    CHECK_EQ(read_file(directory + "rot-1.log"), lines(0, 12));
+    CHECK_EQ(read_file(directory + "rot-2.log"), lines(12, 24));
+}
+
+TEST(every_writer_rotates_the_same)
+{
+    // Buffers smaller than a file, so that some of them are
+    // still being written when the file is rotated
+    const bl::file_options options[] = {
+        bl::file_options::buffered(64),
+        bl::file_options::async_io(16, 4),
+        bl::file_options::mapped(4096)
+    };
+
+    for (auto& option : options)
+    {
+        auto directory = scratch_directory("writers");
+
+        {
+            auto logger = bl::logger::make_file("rot", bl::level::trace, "{msg}", directory, 100, 3, true, option);
+            log_lines(*logger, 0, 30);
+        }
+
+        CHECK_EQ(joined_names(directory), "rot-1.log rot-2.log rot-3.log ");
+        CHECK_EQ(read_file(directory + "rot-1.log"), lines(0, 12));
+        CHECK_EQ(read_file(directory + "rot-2.log"), lines(12, 24));
+        CHECK_EQ(read_file(directory + "rot-3.log"), lines(24, 30));
+    }
+}
+
+// -------- Durability
+
+TEST(every_durability_mode_writes_everything)
+{
+    const bl::durability modes[] = {
+        bl::durability::none,
+        bl::durability::periodic,
+        bl::durability::on_error,
+        bl::durability::group_commit
+    };
+
+    for (auto mode : modes)
+    {
+        for (size_t buffer_size : { 0, 64 })
+        {
+            auto directory = scratch_directory("durability");
+
+            bl::file_options options;
+            options.buffer_size = buffer_size;
+            options.sync_mode = mode;
+            options.sync_interval = std::chrono::milliseconds(5);
+
+            {
+                auto logger = bl::logger::make_async_file("dur", bl::level::trace, "{msg}", directory, 100, 3, true, options);
+
+                for (size_t i = 0; i < 30; ++i)
+                {
+                    if (i % 5 == 0)
+                        logger->error("line {}", i < 10 ? "0" + std::to_string(i) : std::to_string(i));
+                    else
+                        log_lines(*logger, i, i + 1);
+                }
+            }
+
+            CHECK_EQ(joined_names(directory), "dur-1.log dur-2.log dur-3.log ");
+            CHECK_EQ(read_file(directory + "dur-1.log") + read_file(directory + "dur-2.log") + read_file(directory + "dur-3.log"), lines(0, 30));
+        }
+    }
+}
+
+// -------- Time rotation
+
+// Microseconds, moved by hand
+std::atomic<uint64_t> g_fake_time(0);
+
+class fake_clock : public bl::clock_source
+{
+public:
+    uint64_t now() const override
+    {
+        return g_fake_time.load();
+    }
+
+    int64_t to_nanoseconds(uint64_t ticks) const override
+    {
+        return static_cast<int64_t>(ticks) * 1000;
+    }
+
+    uint64_t to_ticks(int64_t nanoseconds) const override
+    {
+        return static_cast<uint64_t>(nanoseconds / 1000);
+    }
+};
+
+// Every line starts with its %H:%M:%S, which has to
+// match the period its file is named after
+void check_periods(const std::string& directory, size_t expected_lines)
+{
+    size_t total = 0;
+
+    for (auto& name : file_names(directory))
+    {
+        // tim-YYYY-mm-dd_HH-MM-SS.log
+        CHECK(name.size() == 27);
+
+        if (name.size() != 27)
+            continue;
+
+        auto period = name.substr(15, 8);
+
+        for (auto& c : period)
+            if (c == '-')
+                c = ':';
+
+        auto text = read_file(directory + name);
+
+        for (size_t begin = 0; begin < text.size();)
+        {
+            auto end = text.find('\n', begin);
+
+            CHECK_EQ(text.substr(begin, 8), period);
+
+            begin = end == std::string::npos ? text.size() : end + 1;
+            ++total;
+        }
+    }
+
+    CHECK(total == expected_lines);
+}
+
+void check_time_rotation(bool asynchronous)
+{
+    auto directory = scratch_directory(asynchronous ? "async-time" : "time");
+
+    bl::file_options options;
+    options.rotation_interval = std::chrono::seconds(1);
+
+    // The first period is taken from the system clock, so stay clear of its next second
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    auto second = std::chrono::duration_cast<std::chrono::seconds>(now);
+
+    if (now - second > std::chrono::milliseconds(800))
+    {
+        std::this_thread::sleep_for(second + std::chrono::seconds(1) - now);
+        ++second;
+    }
+
+    g_fake_time = static_cast<uint64_t>(second.count()) * 1000000 + 1000;
+
+    {
+        auto logger = asynchronous
+            ? bl::logger::make_async_file("tim", bl::level::trace, "{ts} {msg}", directory, bl::infinite, bl::infinite, true, options)
+            : bl::logger::make_file("tim", bl::level::trace, "{ts} {msg}", directory, bl::infinite, bl::infinite, true, options);
+
+        logger->set_clock(std::make_shared<fake_clock>());
+
+        // Nothing may be dropped for the count to add up
+        bl::overflow_options overflow;
+        overflow.policy = bl::overflow_policy::block;
+        overflow.block_timeout = std::chrono::seconds(60);
+        logger->set_overflow_policy(overflow);
+
+        // A little over 3 seconds
+        for (int i = 0; i < 3200; ++i)
+        {
+            g_fake_time += 997;
+            logger->info("m{}", i);
+        }
+    }
+
+    CHECK(file_names(directory).size() == 4);
+    check_periods(directory, 3200);
+}
+
+TEST(rotates_by_time)
+{
+    check_time_rotation(false);
+}
+
+TEST(async_rotates_by_time)
+{
+    check_time_rotation(true);
+}
+
+TEST(rejects_intervals_that_arent_whole_days)
+{
+    auto directory = scratch_directory("bad-interval");
+
+    bl::file_options options;
+    options.rotation_interval = std::chrono::hours(36);
+
+    {
+        auto logger = bl::logger::make_file("tim", bl::level::trace, "{msg}", directory, bl::infinite, bl::infinite, true, options);
+        logger->info("lost");
+    }
+
+    CHECK(file_names(directory).empty());
+}
+
+// -------- Compression
+
+// "Compresses" by copying, or fails on purpose
+class copy_codec : public bl::codec
+{
+private:
+    bool m_works;
+public:
+    explicit copy_codec(bool works)
+        : m_works(works)
+    {
+    }
+
+    const bl::char_t* extension() const override
+    {
+        return ".copy";
+    }
+
+    bool compress(const bl::string& from, const bl::string& to, int) override
+    {
+        if (!m_works)
+            return false;
+
+        make_file(to, read_file(from));
+
+        return true;
+    }
+};
+
+TEST(rotated_files_are_compressed)
+{
+    auto directory = scratch_directory("compression");
+
+    bl::file_options options;
+    options.compression = std::make_shared<copy_codec>(true);
+
+    {
+        auto logger = bl::logger::make_file("rot", bl::level::trace, "{msg}", directory, 100, 3, true, options);
+        log_lines(*logger, 0, 30);
+    }
+
+    CHECK(eventually([&]() { return joined_names(directory) == "rot-1.log.copy rot-2.log.copy rot-3.log "; }));
+    CHECK_EQ(read_file(directory + "rot-1.log.copy"), lines(0, 12));
+    CHECK_EQ(read_file(directory + "rot-2.log.copy"), lines(12, 24));
+    CHECK_EQ(read_file(directory + "rot-3.log"), lines(24, 30));
+}
+
+TEST(files_stay_as_they_are_if_compression_fails)
+{
+    auto directory = scratch_directory("failed-compression");
+
+    bl::file_options options;
+    options.compression = std::make_shared<copy_codec>(false);
+
+    {
+        auto logger = bl::logger::make_file("rot", bl::level::trace, "{msg}", directory, 100, 3, true, options);
+        log_lines(*logger, 0, 30);
+    }
+
+    CHECK(eventually([&]() { return joined_names(directory) == "rot-1.log rot-2.log rot-3.log "; }));
+    CHECK_EQ(read_file(directory + "rot-1.log"), lines(0, 12));
+    CHECK_EQ(read_file(directory + "rot-2.log"), lines(12, 24));
+}
+
+// -------- Shared files
+
+TEST(shared_loggers_append_whole_lines)
+{
+    auto directory = scratch_directory("shared");
+
+    bl::file_options options;
+    options.shared = true;
+
+    // Stands in for two processes
+    std::vector<std::thread> writers;
+
+    for (char writer : { 'a', 'b' })
+    {
+        writers.emplace_back([&directory, &options, writer]()
+        {
+            auto logger = bl::logger::make_file("rot", bl::level::trace, "{msg}", directory, 1000, 9, true, options);
+
+            for (int i = 1000; i < 1300; ++i)
+                logger->info("{} {}", writer, i);
+        });
+    }
+
+    for (auto& writer : writers)
+        writer.join();
+
+    std::string text;
+
+    for (auto& name : file_names(directory))
+    {
+        if (name.compare(0, 4, "rot-") == 0)
+            text += read_file(directory + name);
+    }
+
+    // Every line whole, each writer's in the order it wrote them
+    int next[2] = { 1000, 1000 };
+    bool intact = true;
+
+    for (size_t at = 0; at + 7 <= text.size(); at += 7)
+    {
+        auto line = text.substr(at, 7);
+        int writer = line[0] - 'a';
+
+        if ((writer != 0 && writer != 1) || line != std::string(1, line[0]) + " " + std::to_string(next[writer]) + "\n")
+        {
+            intact = false;
+            break;
+        }
+
+        ++next[writer];
+    }
+
+    CHECK(intact);
+    CHECK(text.size() == 2 * 300 * 7);
+    CHECK(next[0] == 1300 && next[1] == 1300);
+}
+
+// -------- Resuming after a previous run
+
+TEST(resumes_after_the_newest_file)
+{
+    auto directory = scratch_directory("resume");
+
+    {
+        auto logger = bl::logger::make_file("rot", bl::level::trace, "{msg}", directory, 100, 5, true);
+        log_lines(*logger, 0, 30);
+    }
+
+    // Another tag starting with ours isn't one of our files
+    make_file(directory + "rot-io-9.log", "other\n");
+
+    {
+        auto logger = bl::logger::make_file("rot", bl::level::trace, "{msg}", directory, 100, 5, true);
+        log_lines(*logger, 30, 31);
+    }
+
+    CHECK_EQ(joined_names(directory), "rot-1.log rot-2.log rot-3.log rot-4.log rot-io-9.log ");
+    CHECK_EQ(read_file(directory + "rot-3.log"), lines(24, 30));
+    CHECK_EQ(read_file(directory + "rot-4.log"), lines(30, 31));
+}
+
+// -------- Retention
+
+TEST(disk_budget_deletes_the_oldest_files)
+{
+    auto directory = scratch_directory("budget");
+
+    bl::file_options options;
+    options.disk_budget = 250;
+
+    make_file(directory + "other-1.log", numbered("other ", 0, 100));
+
+    {
+        auto logger = bl::logger::make_file("rot", bl::level::trace, "{msg}", directory, 100, bl::infinite, true, options);
+
+        // A file at a time, so that their modification times tell them apart
+        for (size_t file = 0; file < 5; ++file)
+        {
+            log_lines(*logger, file * 12, file * 12 + 12);
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+
+        // Only the current file may take the total over the budget
+        CHECK(eventually([&]() { return total_size(directory, "rot-") <= 250 + 100; }));
+    }
+
+    CHECK(!bl::file_exists(directory + "rot-1.log"));
+    CHECK_EQ(read_file(directory + "rot-5.log"), lines(48, 60));
+    CHECK(bl::file_exists(directory + "other-1.log"));
+}
+
+TEST(max_age_deletes_old_files)
+{
+    auto directory = scratch_directory("age");
+
+    bl::file_options options;
+    options.max_age = std::chrono::hours(1);
+
+    make_file(directory + "rot-1.log", "old\n", 2 * 3600);
+    make_file(directory + "rot-2.log", "recent\n", 60);
+    make_file(directory + "rotx-1.log", "old, not ours\n", 2 * 3600);
+
+    {
+        auto logger = bl::logger::make_file("rot", bl::level::trace, "{msg}", directory, 100, bl::infinite, true, options);
+        log_lines(*logger, 0, 1);
+
+        CHECK(eventually([&]() { return !bl::file_exists(directory + "rot-1.log"); }));
+    }
+
+    CHECK_EQ(read_file(directory + "rot-2.log"), "recent\n");
+    CHECK_EQ(read_file(directory + "rot-3.log"), lines(0, 1));
+    CHECK(bl::file_exists(directory + "rotx-1.log"));
+}
+
+// -------- Routing by tag
+
+TEST(routes_messages_by_tag)
+{
+    auto directory = scratch_directory("routing");
+
+    {
+        auto first = bl::logger::make_custom("db", bl::level::trace, "{msg}", false, bl::sink::make_routing_file(directory));
+        auto second = bl::logger::make_custom("../a*b", bl::level::trace, "{msg}", false, bl::sink::make_routing_file(directory));
+
+        first->info("one");
+        second->info("two");
+        first->info("three");
+    }
+
+    CHECK_EQ(joined_names(directory), "_.._a_b.log db.log ");
+    CHECK_EQ(read_file(directory + "db.log"), "one\nthree\n");
+    CHECK_EQ(read_file(directory + "_.._a_b.log"), "two\n");
+}
+
+int main()
+{
+    return run_tests();
+}
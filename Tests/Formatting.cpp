@@ -0,0 +1,325 @@
+#include "Check.h"
+
+#include <atomic>
+#include <limits>
+#include <sstream>
+
+// -------- Message formatting against the original find-and-replace
+
+// How format() used to work: every argument replaces the first "{n}"
+// where n is the number of arguments placed so far, or else the first
+// "{}", and is skipped if there's neither.
+std::string reference_format(std::string format, const std::vector<std::string>& args)
+{
+    size_t index = 0;
+
+    for (auto& arg : args)
+    {
+        auto placeholder = "{" + std::to_string(index) + "}";
+        auto offset = format.find(placeholder);
+
+        if (offset == std::string::npos)
+        {
+            placeholder = "{}";
+            offset = format.find(placeholder);
+        }
+
+        if (offset == std::string::npos)
+            continue;
+
+        ++index;
+        format.replace(offset, placeholder.size(), arg);
+    }
+
+    return format;
+}
+
+const char* const parity_formats[] = {
+    "",
+    "plain text",
+    "{}",
+    "{} {} {}",
+    "{0} {1} {2}",
+    "{2} {1} {0}",
+    "{1} {0}",
+    "{} {0}",
+    "{0} {}",
+    "{1} {} {}",
+    "{0}{0}",
+    "{} {}",
+    "{} {} {} {}",
+    "{3} {}",
+    "{{}}",
+    "{ } {x} {}",
+    "{01} {}",
+    "{}}",
+    "{{0}",
+    "{65536} {}",
+    "trailing {",
+    "}{ {}{"
+};
+
+TEST(format_matches_the_original_semantics)
+{
+    std::vector<std::string> args = { "7", "two", "c" };
+
+    for (auto* format : parity_formats)
+    {
+        CHECK_EQ(bl::formatter::format(format), reference_format(format, {}));
+        CHECK_EQ(bl::formatter::format(format, 7), reference_format(format, { args[0] }));
+        CHECK_EQ(bl::formatter::format(format, 7, "two"), reference_format(format, { args[0], args[1] }));
+        CHECK_EQ(bl::formatter::format(format, 7, "two", 'c'), reference_format(format, args));
+    }
+}
+
+TEST(compiled_formats_match_text_formats)
+{
+    for (auto* format : parity_formats)
+    {
+        bl::format_string compiled(format);
+
+        CHECK_EQ(bl::formatter::format(compiled, 7, "two", 'c'), bl::formatter::format(format, 7, "two", 'c'));
+    }
+
+    CHECK_EQ(bl::formatter::format(BLOGGER_FORMAT("{1} took {0}ms"), 12, "request"), "request took 12ms");
+}
+
+TEST(arguments_are_never_rescanned)
+{
+    CHECK_EQ(bl::formatter::format("{} {}", "{}", 1), "{} 1");
+    CHECK_EQ(bl::formatter::format("{0} {1}", "{1}", 2), "{1} 2");
+}
+
+TEST(format_strings_are_told_apart)
+{
+    // More formats than cache entries, same sizes and ends
+    for (int round = 0; round < 2; ++round)
+    {
+        for (int i = 0; i < 200; ++i)
+        {
+            auto format = "a" + std::to_string(1000 + i) + " {}";
+            CHECK_EQ(bl::formatter::format(format, i), "a" + std::to_string(1000 + i) + " " + std::to_string(i));
+        }
+    }
+}
+
+struct nested
+{
+    int value;
+};
+
+std::ostream& operator<<(std::ostream& stream, const nested& n)
+{
+    // Formats with the cache while the outer call is using it
+    return stream << bl::formatter::format("<{} {}>", n.value, "inner");
+}
+
+TEST(nested_formatting)
+{
+    CHECK_EQ(bl::formatter::format("{} and {}", nested{ 1 }, nested{ 2 }), "<1 inner> and <2 inner>");
+}
+
+// -------- Deferred formatting on the backend
+
+TEST(deferred_messages_match_immediate_ones)
+{
+    auto immediate = captured::make();
+    auto deferred = captured::make();
+
+    {
+        auto blocking = bl::logger::make_custom("t", bl::level::trace, "[{lvl}] {msg}", false, capture_sink::make(immediate));
+        auto async = bl::logger::make_custom("t", bl::level::trace, "[{lvl}] {msg}", bl::logging_mode::async_ordered, capture_sink::make(deferred));
+
+        async->set_deferred_formatting(true);
+
+        for (auto* format : parity_formats)
+        {
+            std::string owned = "owned";
+
+            blocking->info(format, 7, "two", 'c', owned, 2.5);
+            async->info(format, 7, "two", 'c', owned, 2.5);
+        }
+
+        static const bl::format_string compiled("{1} {0}");
+
+        blocking->warning(compiled, -3, true);
+        async->warning(compiled, -3, true);
+
+        blocking->error("{}", nested{ 5 });
+        async->error("{}", nested{ 5 });
+    }
+
+    auto expected = immediate->lines();
+    auto actual = deferred->lines();
+
+    CHECK(expected.size() == sizeof(parity_formats) / sizeof(parity_formats[0]) + 2);
+    CHECK(actual.size() == expected.size());
+
+    for (size_t i = 0; i < expected.size() && i < actual.size(); ++i)
+        CHECK_EQ(actual[i], expected[i]);
+}
+
+// -------- Argument conversion against std::to_string and operator<<
+
+template<typename T>
+std::string streamed(const T& value)
+{
+    std::ostringstream stream;
+    stream << value;
+    return stream.str();
+}
+
+TEST(numbers_match_std_to_string)
+{
+    CHECK_EQ(bl::formatter::format("{}", 0), std::to_string(0));
+    CHECK_EQ(bl::formatter::format("{}", -1), std::to_string(-1));
+    CHECK_EQ(bl::formatter::format("{}", std::numeric_limits<int>::min()), std::to_string(std::numeric_limits<int>::min()));
+    CHECK_EQ(bl::formatter::format("{}", std::numeric_limits<long long>::min()), std::to_string(std::numeric_limits<long long>::min()));
+    CHECK_EQ(bl::formatter::format("{}", std::numeric_limits<unsigned long long>::max()), std::to_string(std::numeric_limits<unsigned long long>::max()));
+    CHECK_EQ(bl::formatter::format("{}", static_cast<short>(-300)), std::to_string(-300));
+    CHECK_EQ(bl::formatter::format("{}", static_cast<unsigned char>(200)), std::to_string(200));
+
+    const double doubles[] = { 0.0, -0.0, 2.5, -1.0 / 3.0, 1e-7, 123456789.125, 1e300 };
+
+    for (auto d : doubles)
+        CHECK_EQ(bl::formatter::format("{}", d), std::to_string(d));
+
+    CHECK_EQ(bl::formatter::format("{}", 1.5f), std::to_string(1.5f));
+    CHECK_EQ(bl::formatter::format("{} {}", true, false), "1 0");
+    CHECK_EQ(bl::formatter::format("{}", 'x'), "x");
+}
+
+struct streamable
+{
+    int a;
+    const char* b;
+};
+
+std::ostream& operator<<(std::ostream& stream, const streamable& s)
+{
+    return stream << "streamable{" << s.a << ", " << s.b << "}";
+}
+
+TEST(other_types_go_through_operator_insertion)
+{
+    streamable value{ 3, "text" };
+
+    CHECK_EQ(bl::formatter::format("{}", value), streamed(value));
+
+    std::string owned = "owned";
+    const char* literal = "literal";
+
+    CHECK_EQ(bl::formatter::format("{} {} {}", owned, literal, std::string(300, 'l')), "owned literal " + std::string(300, 'l'));
+}
+
+// -------- Patterns
+
+TEST(pattern_tokens)
+{
+    auto output = captured::make();
+
+    {
+        auto logger = bl::logger::make_custom("svc", bl::level::trace, "[{lvl}][{tag}] {msg} {{tag}} {", false, capture_sink::make(output));
+
+        logger->info("hello {}", 1);
+        logger->set_pattern("{msg}|{msg}");
+        logger->warning("twice");
+    }
+
+    auto lines = output->lines();
+
+    CHECK(lines.size() == 2);
+
+    if (lines.size() == 2)
+    {
+        CHECK_EQ(lines[0], "[INFO][svc] hello 1 {svc} {\n");
+        CHECK_EQ(lines[1], "twice|twice\n");
+    }
+}
+
+TEST(long_messages_are_cut)
+{
+    auto output = captured::make();
+
+    bl::formatter::cut_if_exceeds(12, "..");
+    bl::formatter::set_ending(";\n");
+
+    {
+        auto logger = bl::logger::make_custom("t", bl::level::trace, "{lvl}: {msg}", false, capture_sink::make(output));
+
+        logger->info("{}", "short");
+        logger->info("{}", "a little too long");
+    }
+
+    bl::formatter::cut_if_exceeds(bl::infinite);
+    bl::formatter::set_ending();
+
+    auto lines = output->lines();
+
+    CHECK(lines.size() == 2);
+
+    if (lines.size() == 2)
+    {
+        CHECK_EQ(lines[0], "INFO: short;\n");
+        CHECK_EQ(lines[1], "INFO: a li..;\n");
+    }
+}
+
+// Nanoseconds since the epoch, set by hand
+std::atomic<uint64_t> g_fake_time(0);
+
+class fake_clock : public bl::clock_source
+{
+public:
+    uint64_t now() const override
+    {
+        return g_fake_time.load();
+    }
+
+    int64_t to_nanoseconds(uint64_t ticks) const override
+    {
+        return static_cast<int64_t>(ticks);
+    }
+};
+
+TEST(sub_second_timestamps)
+{
+    auto output = captured::make();
+
+    // Seconds don't depend on the time zone
+    bl::formatter::set_timestamp_format("%S");
+
+    {
+        auto logger = bl::logger::make_custom("t", bl::level::trace, "{ts}|{ts:ms}|{ts:us}|{ts:ns}", false, capture_sink::make(output));
+        logger->set_clock(std::make_shared<fake_clock>());
+
+        // 1700000000 is 20 seconds into a minute
+        g_fake_time = 1700000000123456789ull;
+        logger->info("");
+
+        // Same second, the cached text is reused
+        g_fake_time = 1700000000000000007ull;
+        logger->info("");
+
+        g_fake_time = 1700000041999999999ull;
+        logger->info("");
+    }
+
+    bl::formatter::set_timestamp_format();
+
+    auto lines = output->lines();
+
+    CHECK(lines.size() == 3);
+
+    if (lines.size() == 3)
+    {
+        CHECK_EQ(lines[0], "20|20.123|20.123456|20.123456789\n");
+        CHECK_EQ(lines[1], "20|20.000|20.000000|20.000000007\n");
+        CHECK_EQ(lines[2], "01|01.999|01.999999|01.999999999\n");
+    }
+}
+
+int main()
+{
+    return run_tests();
+}
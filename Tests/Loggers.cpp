@@ -0,0 +1,432 @@
+#include "Check.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+
+// -------- Helpers
+
+std::vector<std::string> lines_of(const std::string& prefix, const std::vector<std::string>& lines)
+{
+    std::vector<std::string> result;
+
+    for (auto& line : lines)
+    {
+        if (line.compare(0, prefix.size(), prefix) == 0)
+            result.push_back(line);
+    }
+
+    return result;
+}
+
+// Every producer's lines in the order it logged them
+bool in_order_per_producer(const std::vector<std::string>& lines, int producers, int count)
+{
+    for (int p = 0; p < producers; ++p)
+    {
+        auto mine = lines_of("t" + std::to_string(p) + " ", lines);
+
+        if (mine.size() != static_cast<size_t>(count))
+            return false;
+
+        for (int i = 0; i < count; ++i)
+        {
+            if (mine[i] != "t" + std::to_string(p) + " " + std::to_string(i) + "\n")
+                return false;
+        }
+    }
+
+    return true;
+}
+
+bl::overflow_options never_drop()
+{
+    bl::overflow_options options;
+    options.policy = bl::overflow_policy::block;
+    options.block_timeout = std::chrono::seconds(60);
+
+    return options;
+}
+
+void log_from_threads(bl::logger& logger, int producers, int count)
+{
+    std::vector<std::thread> threads;
+
+    for (int p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&logger, p, count]()
+        {
+            for (int i = 0; i < count; ++i)
+                logger.info("t{} {}", p, i);
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+}
+
+// -------- Pattern versions
+
+TEST(messages_keep_the_pattern_they_were_logged_with)
+{
+    auto output = captured::make(false);
+
+    {
+        auto logger = bl::logger::make_custom("t", bl::level::trace, "old {msg}", bl::logging_mode::async_ordered, capture_sink::make(output));
+
+        logger->info("m0");
+        output->wait_entered();
+
+        logger->info("m1");
+        logger->set_pattern("new {msg}");
+        logger->info("m2");
+        logger->set_tag("renamed");
+        logger->set_pattern("{tag} {msg}");
+        logger->info("m3");
+
+        output->open();
+    }
+
+    auto lines = output->lines();
+
+    CHECK(lines.size() == 4);
+
+    if (lines.size() == 4)
+    {
+        CHECK_EQ(lines[0], "old m0\n");
+        CHECK_EQ(lines[1], "old m1\n");
+        CHECK_EQ(lines[2], "new m2\n");
+        CHECK_EQ(lines[3], "renamed m3\n");
+    }
+}
+
+// -------- Clock sources
+
+int64_t system_nanoseconds()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()
+    ).count();
+}
+
+TEST(clocks_agree_with_the_system_clock)
+{
+    // The coarse clock is only as precise as the kernel tick
+    constexpr int64_t tolerance = 20 * 1000000;
+
+    const bl::clock_source::ptr clocks[] = {
+        bl::clock_source::make_system(),
+        bl::clock_source::make_coarse(),
+        bl::clock_source::make_tsc()
+    };
+
+    for (auto& clock : clocks)
+    {
+        auto before = system_nanoseconds();
+        auto ticks = clock->now();
+        auto after = system_nanoseconds();
+
+        auto time = clock->to_nanoseconds(ticks);
+
+        CHECK(time >= before - tolerance);
+        CHECK(time <= after + tolerance);
+
+        // Roughly back to the same ticks
+        auto back = clock->to_nanoseconds(clock->to_ticks(time));
+
+        CHECK(std::llabs(back - time) < 1000000);
+    }
+}
+
+// -------- Queues
+
+TEST(ring_buffer_is_bounded_and_first_in_first_out)
+{
+    bl::ring_buffer<int> queue(5);
+
+    CHECK(queue.capacity() == 8);
+    CHECK(queue.empty());
+
+    for (int i = 0; i < 8; ++i)
+        CHECK(queue.try_push(i));
+
+    int extra = 8;
+    CHECK(!queue.try_push(extra));
+
+    for (int i = 0; i < 8; ++i)
+    {
+        int value = -1;
+
+        CHECK(queue.try_pop(value));
+        CHECK(value == i);
+    }
+
+    int none;
+    CHECK(!queue.try_pop(none));
+}
+
+TEST(ring_buffer_with_many_producers_and_consumers)
+{
+    constexpr int threads = 4;
+    constexpr int per_producer = 20000;
+
+    bl::ring_buffer<int> queue(64);
+
+    std::atomic<int>       consumed(0);
+    std::atomic<long long> sum(0);
+
+    // Every consumer sees each producer's items in order
+    std::atomic<bool> ordered(true);
+
+    std::vector<std::thread> workers;
+
+    for (int p = 0; p < threads; ++p)
+    {
+        workers.emplace_back([&queue, p]()
+        {
+            for (int i = 0; i < per_producer; ++i)
+            {
+                int item = p * per_producer + i;
+
+                while (!queue.try_push(item))
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    for (int c = 0; c < threads; ++c)
+    {
+        workers.emplace_back([&]()
+        {
+            std::vector<int> last(threads, -1);
+            int item;
+
+            while (consumed.load() < threads * per_producer)
+            {
+                if (!queue.try_pop(item))
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                auto& previous = last[item / per_producer];
+
+                if (item <= previous)
+                    ordered = false;
+
+                previous = item;
+                sum += item;
+                ++consumed;
+            }
+        });
+    }
+
+    for (auto& worker : workers)
+        worker.join();
+
+    long long total = threads * per_producer;
+
+    CHECK(consumed == total);
+    CHECK(sum == total * (total - 1) / 2);
+    CHECK(ordered);
+}
+
+// -------- Ordered backend
+
+// Numbers start at 1
+TEST(ordered_logger_numbers_messages_in_order)
+{
+    auto output = captured::make();
+
+    {
+        auto logger = bl::logger::make_custom("t", bl::level::trace, "{msg}|{seq}", bl::logging_mode::async_ordered, capture_sink::make(output));
+        logger->set_overflow_policy(never_drop());
+
+        log_from_threads(*logger, 4, 500);
+    }
+
+    auto lines = output->lines();
+    std::vector<std::string> messages;
+    bool numbered = true;
+
+    for (size_t i = 0; i < lines.size(); ++i)
+    {
+        auto bar = lines[i].find('|');
+
+        if (bar == std::string::npos || lines[i].substr(bar + 1) != std::to_string(i + 1) + "\n")
+            numbered = false;
+        else
+            messages.push_back(lines[i].substr(0, bar) + "\n");
+    }
+
+    CHECK(lines.size() == 2000);
+    CHECK(numbered);
+    CHECK(in_order_per_producer(messages, 4, 500));
+}
+
+// -------- Per-thread queues
+
+TEST(spsc_ring_buffer_is_first_in_first_out)
+{
+    bl::spsc_ring_buffer<int> queue(3);
+
+    CHECK(queue.capacity() == 4);
+
+    for (int round = 0; round < 3; ++round)
+    {
+        for (int i = 0; i < 4; ++i)
+            CHECK(queue.try_push(i));
+
+        int extra = 4;
+        CHECK(!queue.try_push(extra));
+
+        for (int i = 0; i < 4; ++i)
+        {
+            CHECK(queue.front() && *queue.front() == i);
+            queue.pop();
+        }
+
+        CHECK(queue.empty());
+        CHECK(!queue.front());
+    }
+}
+
+TEST(per_thread_logger_delivers_every_thread_in_order)
+{
+    auto output = captured::make();
+
+    {
+        auto logger = bl::logger::make_custom("t", bl::level::trace, "{msg}", bl::logging_mode::async_per_thread, capture_sink::make(output));
+        logger->set_overflow_policy(never_drop());
+
+        log_from_threads(*logger, 4, 500);
+    }
+
+    CHECK(output->lines().size() == 2000);
+    CHECK(in_order_per_producer(output->lines(), 4, 500));
+}
+
+// Ticks are nanoseconds, each thread sets its own
+thread_local uint64_t t_fake_time = 0;
+
+class thread_clock : public bl::clock_source
+{
+public:
+    uint64_t now() const override
+    {
+        return t_fake_time;
+    }
+
+    int64_t to_nanoseconds(uint64_t ticks) const override
+    {
+        return static_cast<int64_t>(ticks);
+    }
+};
+
+TEST(per_thread_queues_are_merged_by_time)
+{
+    auto output = captured::make(false);
+
+    {
+        auto logger = bl::logger::make_custom("t", bl::level::trace, "{msg}", bl::logging_mode::async_per_thread, capture_sink::make(output));
+        logger->set_clock(std::make_shared<thread_clock>());
+
+        logger->info("first");
+        output->wait_entered();
+
+        // Both queues fill up while the worker is held, one after the other
+        for (uint64_t start : { 10, 20 })
+        {
+            std::thread([&logger, start]()
+            {
+                for (uint64_t time = start; time < 100; time += 20)
+                {
+                    t_fake_time = time;
+                    logger->info("{}", time);
+                }
+            }).join();
+        }
+
+        output->open();
+    }
+
+    std::string text;
+
+    for (auto& line : output->lines())
+        text += line;
+
+    CHECK_EQ(text, "first\n10\n20\n30\n40\n50\n60\n70\n80\n90\n");
+}
+
+// -------- Batches
+
+// Records how many messages each call was given
+class batch_sink : public bl::sink
+{
+private:
+    captured::ptr        m_output;
+    std::vector<size_t>& m_batches;
+public:
+    batch_sink(captured::ptr output, std::vector<size_t>& batches)
+        : m_output(std::move(output)),
+          m_batches(batches)
+    {
+    }
+
+    void write(bl::log_message& msg) override
+    {
+        m_batches.push_back(1);
+        m_output->add(msg);
+    }
+
+    void write_batch(bl::log_message* const* messages, size_t count) override
+    {
+        m_batches.push_back(count);
+
+        for (size_t i = 0; i < count; ++i)
+            m_output->add(*messages[i]);
+    }
+
+    void flush() override
+    {
+        m_output->flushed();
+    }
+};
+
+TEST(queued_messages_are_written_in_batches)
+{
+    constexpr size_t most = bl::task_batch::default_capacity;
+
+    auto output = captured::make(false);
+    std::vector<size_t> batches;
+
+    {
+        auto logger = bl::logger::make_custom("t", bl::level::trace, "{msg}", bl::logging_mode::async_ordered, bl::sink::ptr(new batch_sink(output, batches)));
+        logger->set_overflow_policy(never_drop());
+
+        logger->info("m{}", 0);
+        output->wait_entered();
+
+        // More than a worker takes in one go
+        for (size_t i = 1; i <= most + 10; ++i)
+            logger->info("m{}", i);
+
+        output->open();
+        output->flush(*logger);
+    }
+
+    CHECK(output->lines().size() == most + 11);
+    CHECK(batches.size() == 3);
+
+    if (batches.size() == 3)
+    {
+        CHECK(batches[0] == 1);
+        CHECK(batches[1] == most);
+        CHECK(batches[2] == 10);
+    }
+}
+
+int main()
+{
+    return run_tests();
+}
@@ -0,0 +1,291 @@
+#include "Check.h"
+
+#include <thread>
+
+// Every test holds the logger's backend inside the write of a first
+// message, posts the rest while nothing can be given back, and then
+// lets it go. The first message dropped on the spot also queues
+// a "N messages dropped" line.
+
+bool is_report(const std::string& line)
+{
+    return line.find("messages dropped") != std::string::npos;
+}
+
+// The lines that aren't drop reports, and how many of those there were
+std::vector<std::string> messages(const std::vector<std::string>& lines, size_t& reports)
+{
+    std::vector<std::string> result;
+    reports = 0;
+
+    for (auto& line : lines)
+    {
+        if (is_report(line))
+            ++reports;
+        else
+            result.push_back(line);
+    }
+
+    return result;
+}
+
+std::string numbered(const char* prefix, size_t from, size_t to)
+{
+    std::string text;
+
+    for (size_t i = from; i < to; ++i)
+        text += prefix + std::to_string(i) + "\n";
+
+    return text;
+}
+
+std::string joined(const std::vector<std::string>& lines)
+{
+    std::string text;
+
+    for (auto& line : lines)
+        text += line;
+
+    return text;
+}
+
+struct overflow_run
+{
+    std::vector<std::string> lines;
+    uint64_t                 dropped;
+};
+
+overflow_run post_stuck(const bl::overflow_options& options, size_t count)
+{
+    auto output = captured::make(false);
+    overflow_run run;
+
+    {
+        auto logger = bl::logger::make_custom("t", bl::level::trace, "{msg}", bl::logging_mode::async_ordered, capture_sink::make(output));
+
+        logger->set_overflow_policy(options);
+
+        logger->info("m{}", 0);
+        output->wait_entered();
+
+        for (size_t i = 1; i < count; ++i)
+            logger->info("m{}", i);
+
+        output->open();
+        output->flush(*logger);
+
+        run.dropped = logger->dropped_messages();
+    }
+
+    run.lines = output->lines();
+
+    return run;
+}
+
+TEST(nothing_is_dropped_below_the_limit)
+{
+    auto output = captured::make();
+    uint64_t dropped;
+
+    {
+        auto logger = bl::logger::make_custom("t", bl::level::trace, "{msg}", bl::logging_mode::async, capture_sink::make(output));
+
+        for (int i = 0; i < 500; ++i)
+            logger->info("m{}", i);
+
+        output->flush(*logger);
+
+        dropped = logger->dropped_messages();
+    }
+
+    CHECK(dropped == 0);
+    CHECK(output->lines().size() == 500);
+}
+
+TEST(drop_newest_keeps_the_first_messages)
+{
+    bl::overflow_options options;
+    options.policy = bl::overflow_policy::drop_newest;
+    options.queue_limit = 8;
+
+    auto run = post_stuck(options, 20);
+
+    size_t reports;
+    auto kept = messages(run.lines, reports);
+
+    CHECK(run.dropped == 12);
+    CHECK(reports == 1);
+    CHECK_EQ(joined(kept), numbered("m", 0, 8));
+}
+
+TEST(block_drops_once_the_timeout_runs_out)
+{
+    bl::overflow_options options;
+    options.policy = bl::overflow_policy::block;
+    options.queue_limit = 8;
+    options.block_timeout = std::chrono::milliseconds(1);
+
+    auto run = post_stuck(options, 20);
+
+    size_t reports;
+    auto kept = messages(run.lines, reports);
+
+    CHECK(run.dropped == 12);
+    CHECK(reports == 1);
+    CHECK_EQ(joined(kept), numbered("m", 0, 8));
+}
+
+TEST(block_waits_for_room)
+{
+    auto output = captured::make(false);
+    uint64_t dropped;
+
+    {
+        auto logger = bl::logger::make_custom("t", bl::level::trace, "{msg}", bl::logging_mode::async_ordered, capture_sink::make(output));
+
+        bl::overflow_options options;
+        options.policy = bl::overflow_policy::block;
+        options.queue_limit = 8;
+        options.block_timeout = std::chrono::seconds(60);
+        logger->set_overflow_policy(options);
+
+        logger->info("m{}", 0);
+        output->wait_entered();
+
+        std::thread opener([&output]()
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            output->open();
+        });
+
+        for (int i = 1; i < 20; ++i)
+            logger->info("m{}", i);
+
+        opener.join();
+        output->flush(*logger);
+
+        dropped = logger->dropped_messages();
+    }
+
+    CHECK(dropped == 0);
+    CHECK_EQ(joined(output->lines()), numbered("m", 0, 20));
+}
+
+TEST(drop_oldest_keeps_the_latest_messages)
+{
+    bl::overflow_options options;
+    options.policy = bl::overflow_policy::drop_oldest;
+    options.queue_limit = 8;
+
+    auto run = post_stuck(options, 20);
+
+    size_t reports;
+    auto kept = messages(run.lines, reports);
+
+    // m0 was already being written, every later message pushed out
+    // the oldest one still queued. Those are only counted once the
+    // backend skips them, too late for a report.
+    CHECK(run.dropped == 12);
+    CHECK(reports == 0);
+    CHECK_EQ(joined(kept), "m0\n" + numbered("m", 13, 20));
+}
+
+TEST(drop_by_level_keeps_room_for_critical_messages)
+{
+    auto output = captured::make(false);
+    uint64_t dropped;
+
+    {
+        auto logger = bl::logger::make_custom("t", bl::level::trace, "{msg}", bl::logging_mode::async_ordered, capture_sink::make(output));
+
+        bl::overflow_options options;
+        options.policy = bl::overflow_policy::drop_by_level;
+        options.queue_limit = 8;
+        logger->set_overflow_policy(options);
+
+        logger->info("m{}", 0);
+        output->wait_entered();
+
+        // Errors fit while fewer than 7 of 8 are in flight,
+        // the first one dropped queues the report
+        for (int i = 0; i < 10; ++i)
+            logger->error("e{}", i);
+
+        // Warnings only fit below 6
+        for (int i = 0; i < 5; ++i)
+            logger->warning("w{}", i);
+
+        for (int i = 0; i < 3; ++i)
+            logger->critical("c{}", i);
+
+        output->open();
+        output->flush(*logger);
+
+        dropped = logger->dropped_messages();
+    }
+
+    size_t reports;
+    auto kept = messages(output->lines(), reports);
+
+    CHECK(dropped == 9);
+    CHECK(reports == 1);
+    CHECK_EQ(joined(kept), "m0\n" + numbered("e", 0, 6) + numbered("c", 0, 3));
+}
+
+TEST(drop_by_level_never_drops_critical_messages)
+{
+    auto output = captured::make();
+    uint64_t dropped;
+
+    {
+        auto logger = bl::logger::make_custom("t", bl::level::trace, "{msg}", bl::logging_mode::async, capture_sink::make(output));
+
+        bl::overflow_options options;
+        options.policy = bl::overflow_policy::drop_by_level;
+        options.queue_limit = 16;
+        logger->set_overflow_policy(options);
+
+        std::vector<std::thread> producers;
+
+        for (int p = 0; p < 4; ++p)
+        {
+            producers.emplace_back([&logger]()
+            {
+                for (int i = 0; i < 2000; ++i)
+                {
+                    logger->error("e{}", i);
+
+                    if (i % 20 == 0)
+                        logger->critical("c{}", i);
+                }
+            });
+        }
+
+        for (auto& producer : producers)
+            producer.join();
+
+        output->flush(*logger);
+
+        dropped = logger->dropped_messages();
+    }
+
+    size_t critical = 0, errors = 0, reports = 0;
+
+    for (auto& line : output->lines())
+    {
+        if (line[0] == 'c')
+            ++critical;
+        else if (line[0] == 'e')
+            ++errors;
+        else if (is_report(line))
+            ++reports;
+    }
+
+    CHECK(critical == 4 * 100);
+    CHECK(errors + dropped == 4 * 2000);
+}
+
+int main()
+{
+    return run_tests();
+}
@@ -55,14 +55,32 @@ namespace bl {
         in_string directory_path,
         size_t bytes_per_file,
         size_t max_log_files,
-        bool rotate_logs
+        bool rotate_logs,
+        const file_options& options
     )
     {
         return std::make_unique<file_sink>(
             directory_path,
             bytes_per_file,
             max_log_files,
-            rotate_logs
+            rotate_logs,
+            options
+        );
+    }
+
+    inline sink::ptr sink::make_binary(in_string path)
+    {
+        return std::make_unique<binary_sink>(path);
+    }
+
+    inline sink::ptr sink::make_routing_file(
+        in_string directory_path,
+        size_t max_open_files,
+        const file_options& options
+    )
+    {
+        return std::make_unique<shared_sink>(
+            routing_file_sink::get(directory_path, max_open_files, options)
         );
     }
 
@@ -78,10 +96,27 @@ namespace bl {
         in_string pattern,
         bool asynchronous,
         Sinks... sinks)
+    {
+        return logger::make_custom(
+            tag,
+            lvl,
+            pattern,
+            asynchronous ? logging_mode::async : logging_mode::blocking,
+            std::move(sinks)...
+        );
+    }
+
+    template<typename... Sinks>
+    enable_if_sink_ptr_t<logger::ptr, Sinks...> logger::make_custom(
+        in_string tag,
+        level lvl,
+        in_string pattern,
+        logging_mode mode,
+        Sinks... sinks)
     {
         ptr out_logger;
 
-        if (asynchronous)
+        if (mode != logging_mode::blocking)
         {
             // 'magic statics'
             global_console_write_lock();
@@ -89,12 +124,17 @@ namespace bl {
             formatter::overflow_postfix();
             formatter::max_length();
             formatter::ending();
-            thread_pool::get();
+
+            if (mode == logging_mode::async_per_thread)
+                per_thread_backend::get();
+            else if (mode == logging_mode::async)
+                thread_pool::get();
 
             out_logger = std::make_shared<async_logger>(
                 tag,
                 lvl,
-                false
+                false,
+                mode
             );
         }
         else
@@ -151,7 +191,8 @@ namespace bl {
         in_string directory_path,
         size_t bytes_per_file,
         size_t max_log_files,
-        bool rotate_logs
+        bool rotate_logs,
+        const file_options& options
     )
     {
         return logger::make_custom(
@@ -163,7 +204,8 @@ namespace bl {
                 directory_path,
                 bytes_per_file,
                 max_log_files,
-                rotate_logs
+                rotate_logs,
+                options
             )
         );
     }
@@ -175,7 +217,8 @@ namespace bl {
         in_string directory_path,
         size_t bytes_per_file,
         size_t max_log_files,
-        bool rotate_logs
+        bool rotate_logs,
+        const file_options& options
     )
     {
         return logger::make_custom(
@@ -187,7 +230,8 @@ namespace bl {
                 directory_path,
                 bytes_per_file,
                 max_log_files,
-                rotate_logs
+                rotate_logs,
+                options
             )
         );
     }
@@ -209,3 +253,7 @@ namespace bl {
 #undef BLOGGER_UPDATE_TIME
 
 #undef BLOGGER_STACK_ALLOC
+
+#undef BLOGGER_HAS_RDTSC
+#undef BLOGGER_RDTSC
+#undef BLOGGER_PIPE_BUF
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <cstring>
+#include <algorithm>
+
+#include "blogger/core.h"
+
+// Characters every log message can hold without
+// touching the heap. Longer messages still work,
+// they just fall back to a heap allocation.
+#ifndef BLOGGER_MESSAGE_BUFFER_SIZE
+    #define BLOGGER_MESSAGE_BUFFER_SIZE 256
+#endif
+
+namespace bl {
+
+    // A string-like buffer with inline storage for
+    // the first InlineCapacity characters.
+    template<size_t InlineCapacity>
+    class basic_buffer
+    {
+    private:
+        char_t* m_data;
+        size_t  m_size;
+        size_t  m_capacity;
+        char_t  m_inline[InlineCapacity];
+    public:
+        basic_buffer() noexcept
+            : m_data(m_inline),
+              m_size(0),
+              m_capacity(InlineCapacity)
+        {
+        }
+
+        basic_buffer(const char_t* data, size_t size)
+            : basic_buffer()
+        {
+            append(data, size);
+        }
+
+        basic_buffer(const basic_buffer& other)
+            : basic_buffer()
+        {
+            append(other.data(), other.size());
+        }
+
+        basic_buffer(basic_buffer&& other) noexcept
+            : basic_buffer()
+        {
+            take(other);
+        }
+
+        basic_buffer& operator=(const basic_buffer& other)
+        {
+            if (this != &other)
+            {
+                clear();
+                append(other.data(), other.size());
+            }
+
+            return *this;
+        }
+
+        basic_buffer& operator=(basic_buffer&& other) noexcept
+        {
+            if (this != &other)
+            {
+                release();
+                take(other);
+            }
+
+            return *this;
+        }
+
+        ~basic_buffer()
+        {
+            release();
+        }
+
+        void reserve(size_t capacity)
+        {
+            if (capacity <= m_capacity)
+                return;
+
+            capacity = std::max(capacity, m_capacity * 2);
+
+            auto* data = new char_t[capacity];
+            std::memcpy(data, m_data, m_size * sizeof(char_t));
+
+            release();
+
+            m_data = data;
+            m_capacity = capacity;
+        }
+
+        void resize(size_t size)
+        {
+            reserve(size);
+            m_size = size;
+        }
+
+        void clear() noexcept
+        {
+            m_size = 0;
+        }
+
+        void append(const char_t* data, size_t size)
+        {
+            reserve(m_size + size);
+            std::memcpy(m_data + m_size, data, size * sizeof(char_t));
+            m_size += size;
+        }
+
+        void append(size_t count, char_t c)
+        {
+            reserve(m_size + count);
+            std::fill_n(m_data + m_size, count, c);
+            m_size += count;
+        }
+
+        void push_back(char_t c)
+        {
+            reserve(m_size + 1);
+            m_data[m_size++] = c;
+        }
+
+        basic_buffer& operator+=(const string& str)
+        {
+            append(str.data(), str.size());
+            return *this;
+        }
+
+        basic_buffer& operator+=(char_t c)
+        {
+            push_back(c);
+            return *this;
+        }
+
+        char_t* data() noexcept
+        {
+            return m_data;
+        }
+
+        const char_t* data() const noexcept
+        {
+            return m_data;
+        }
+
+        // Same as data() but null terminated
+        const char_t* c_str()
+        {
+            reserve(m_size + 1);
+            m_data[m_size] = BLOGGER_WIDEN_IF_NEEDED('\0');
+
+            return m_data;
+        }
+
+        size_t size() const noexcept
+        {
+            return m_size;
+        }
+
+        size_t capacity() const noexcept
+        {
+            return m_capacity;
+        }
+
+        bool empty() const noexcept
+        {
+            return m_size == 0;
+        }
+
+        bool on_heap() const noexcept
+        {
+            return m_data != m_inline;
+        }
+    private:
+        void take(basic_buffer& other) noexcept
+        {
+            if (other.on_heap())
+            {
+                m_data = other.m_data;
+                m_capacity = other.m_capacity;
+            }
+            else
+            {
+                m_data = m_inline;
+                m_capacity = InlineCapacity;
+                std::memcpy(m_inline, other.m_inline, other.m_size * sizeof(char_t));
+            }
+
+            m_size = other.m_size;
+
+            other.m_data = other.m_inline;
+            other.m_capacity = InlineCapacity;
+            other.m_size = 0;
+        }
+
+        void release() noexcept
+        {
+            if (on_heap())
+                delete[] m_data;
+
+            m_data = m_inline;
+            m_capacity = InlineCapacity;
+        }
+    };
+
+    using message_buffer = basic_buffer<BLOGGER_MESSAGE_BUFFER_SIZE>;
+
+    // A per-thread T that keeps its storage between uses.
+    // A nested use on the same thread, e.g. from an operator<<
+    // that logs, gets a T of its own instead of clobbering the
+    // one still in use. Tag keeps unrelated call sites apart.
+    template<typename T, typename Tag>
+    class thread_scratch
+    {
+    private:
+        struct slot
+        {
+            T    object;
+            bool busy = false;
+        };
+
+        slot* m_slot;
+        T*    m_object;
+        T     m_nested;
+    public:
+        thread_scratch()
+            : m_slot(&local()),
+              m_object(&m_nested)
+        {
+            if (m_slot->busy)
+                m_slot = nullptr;
+            else
+            {
+                m_slot->busy = true;
+                m_object = &m_slot->object;
+            }
+        }
+
+        thread_scratch(const thread_scratch&) = delete;
+        thread_scratch& operator=(const thread_scratch&) = delete;
+
+        ~thread_scratch()
+        {
+            if (m_slot)
+                m_slot->busy = false;
+        }
+
+        T& operator*()
+        {
+            return *m_object;
+        }
+
+        T* operator->()
+        {
+            return m_object;
+        }
+    private:
+        static slot& local()
+        {
+            static thread_local slot s_slot;
+            return s_slot;
+        }
+    };
+}
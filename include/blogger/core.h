@@ -1,6 +1,9 @@
 #pragma once
 
 #include <utility>
+#include <type_traits>
+#include <cstring>
+#include <cstdio>
 #include <iostream>
 #include <vector>
 #include <mutex>
@@ -66,9 +69,15 @@ namespace bl {
     #define BLOGGER_VA_FOR_EACH_DO(what, args_t, args, ...) (what(__VA_ARGS__, std::forward<args_t>(args)), ...)
     #define BLOGGER_FOR_EACH_DO(what, args_t, args) (what(std::forward<args_t>(args)), ...)
     #include <string_view>
+    #include <charconv>
     namespace bl {
         using in_string = std::basic_string_view<char_t, std::char_traits<char_t>>;
     }
+    #define BLOGGER_HAS_STRING_VIEW
+    #define BLOGGER_HAS_TO_CHARS
+    #ifdef __cpp_lib_to_chars
+        #define BLOGGER_HAS_FLOAT_TO_CHARS
+    #endif
 #elif _MSVC_LANG >= 201402L || __cplusplus >= 201402L
     #define BLOGGER_VA_FOR_EACH_DO(what, args_t, args, ...) int _[] = { 0, ( what(__VA_ARGS__, std::forward<args_t>(args)), 0) ... }
     #define BLOGGER_FOR_EACH_DO(what, args_t, args) int _[] = { 0, ( what(std::forward<args_t>(args)), 0) ... }
@@ -160,6 +169,173 @@ namespace bl {
         return string(1, arg);
     }
 
+    // ---- Conversion straight into an output buffer ----
+    // Arguments are appended to anything with a string-like
+    // append(const char_t*, size_t)/push_back(char_t)/reserve(size_t)
+    // interface. Only user types go through operator<<.
+
+    template<typename Buffer>
+    void append_narrow(Buffer& out, const char* chars, size_t size)
+    {
+      #ifdef BLOGGER_UNICODE_MODE
+        out.reserve(out.size() + size);
+
+        for (size_t i = 0; i < size; ++i)
+            out.push_back(static_cast<char_t>(chars[i]));
+      #else
+        out.append(chars, size);
+      #endif
+    }
+
+    enum class append_kind
+    {
+        boolean,
+        character,
+        integer,
+        floating,
+        c_string,
+        std_string,
+        string_view,
+        insertable
+    };
+
+    template<typename T, typename U = typename std::decay<T>::type>
+    struct append_kind_of
+    {
+        static constexpr append_kind value =
+            std::is_same<U, bool>::value              ? append_kind::boolean    :
+            std::is_same<U, char_t>::value            ? append_kind::character  :
+            std::is_integral<U>::value                ? append_kind::integer    :
+            std::is_floating_point<U>::value          ? append_kind::floating   :
+            std::is_same<U, const char_t*>::value ||
+            std::is_same<U, char_t*>::value           ? append_kind::c_string   :
+            std::is_same<U, string>::value            ? append_kind::std_string :
+          #ifdef BLOGGER_HAS_STRING_VIEW
+            std::is_same<U, in_string>::value         ? append_kind::string_view :
+          #endif
+                                                        append_kind::insertable;
+    };
+
+    template<append_kind K>
+    using append_tag = std::integral_constant<append_kind, K>;
+
+    template<typename Buffer>
+    void append_to(Buffer& out, bool arg, append_tag<append_kind::boolean>)
+    {
+        // Matches what std::to_string and operator<< print
+        out.push_back(arg ? BLOGGER_WIDEN_IF_NEEDED('1') : BLOGGER_WIDEN_IF_NEEDED('0'));
+    }
+
+    template<typename Buffer>
+    void append_to(Buffer& out, char_t arg, append_tag<append_kind::character>)
+    {
+        out.push_back(arg);
+    }
+
+    template<typename Buffer, typename T>
+    void append_to(Buffer& out, T arg, append_tag<append_kind::integer>)
+    {
+        // Enough for a 64-bit integer and a sign
+        constexpr size_t max_digits = 24;
+        char chars[max_digits];
+
+      #ifdef BLOGGER_HAS_TO_CHARS
+        using widest_t = typename std::conditional<std::is_signed<T>::value, long long, unsigned long long>::type;
+
+        auto result = std::to_chars(chars, chars + max_digits, static_cast<widest_t>(arg));
+        append_narrow(out, chars, result.ptr - chars);
+      #else
+        bool negative = arg < 0;
+
+        auto value = static_cast<unsigned long long>(arg);
+        if (negative)
+            value = 0ull - value;
+
+        char* begin = chars + max_digits;
+
+        do
+        {
+            *--begin = static_cast<char>('0' + value % 10);
+            value /= 10;
+        } while (value);
+
+        if (negative)
+            *--begin = '-';
+
+        append_narrow(out, begin, chars + max_digits - begin);
+      #endif
+    }
+
+    template<typename Buffer, typename T>
+    void append_to(Buffer& out, T arg, append_tag<append_kind::floating>)
+    {
+        // Plenty for anything but absurdly large values,
+        // which fall back to std::to_string.
+        constexpr size_t max_chars = 64;
+        char chars[max_chars];
+
+        // Same fixed notation with 6 digits std::to_string uses
+      #ifdef BLOGGER_HAS_FLOAT_TO_CHARS
+        auto result = std::to_chars(chars, chars + max_chars, arg, std::chars_format::fixed, 6);
+
+        if (result.ec == std::errc())
+        {
+            append_narrow(out, chars, result.ptr - chars);
+            return;
+        }
+      #else
+        auto written = std::is_same<T, long double>::value ?
+            std::snprintf(chars, max_chars, "%Lf", static_cast<long double>(arg)) :
+            std::snprintf(chars, max_chars, "%f", static_cast<double>(arg));
+
+        if (written > 0 && static_cast<size_t>(written) < max_chars)
+        {
+            append_narrow(out, chars, written);
+            return;
+        }
+      #endif
+
+        auto fallback = BLOGGER_STD_TO_STRING(arg);
+        out.append(fallback.data(), fallback.size());
+    }
+
+    template<typename Buffer>
+    void append_to(Buffer& out, const char_t* arg, append_tag<append_kind::c_string>)
+    {
+        if (arg)
+            out.append(arg, BLOGGER_STRING_LENGTH(arg));
+    }
+
+    template<typename Buffer>
+    void append_to(Buffer& out, const string& arg, append_tag<append_kind::std_string>)
+    {
+        out.append(arg.data(), arg.size());
+    }
+
+  #ifdef BLOGGER_HAS_STRING_VIEW
+    template<typename Buffer>
+    void append_to(Buffer& out, in_string arg, append_tag<append_kind::string_view>)
+    {
+        out.append(arg.data(), arg.size());
+    }
+  #endif
+
+    template<typename Buffer, typename T>
+    void append_to(Buffer& out, T&& arg, append_tag<append_kind::insertable>)
+    {
+        stringstream ss;
+        ss << std::forward<T>(arg);
+
+        auto str = ss.str();
+        out.append(str.data(), str.size());
+    }
+
+    template<typename Buffer, typename T>
+    void append_to(Buffer& out, T&& arg)
+    {
+        append_to(out, std::forward<T>(arg), append_tag<append_kind_of<T>::value>());
+    }
+
     constexpr size_t infinite = 0u;
 }
 
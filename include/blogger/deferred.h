@@ -0,0 +1,579 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <type_traits>
+
+#include "blogger/core.h"
+#include "blogger/buffer.h"
+#include "blogger/formatter.h"
+
+namespace bl {
+
+    // Opt-in for user types that should be captured as raw
+    // bytes instead of being formatted on the logging thread.
+    // Specialize it with enabled = true and
+    //     static size_t size(const T&);
+    //     static void write(char* out, const T&);
+    //     static void append(message_buffer& out, const char* data, size_t size);
+    // or simply derive from trivial_serializer<T>.
+    template<typename T>
+    struct serializer
+    {
+        static constexpr bool enabled = false;
+    };
+
+    // Copies T as is and prints it with operator<< on the backend
+    template<typename T>
+    struct trivial_serializer
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "T has to be trivially copyable");
+
+        static constexpr bool enabled = true;
+
+        static size_t size(const T&)
+        {
+            return sizeof(T);
+        }
+
+        static void write(char* out, const T& value)
+        {
+            std::memcpy(out, &value, sizeof(T));
+        }
+
+        static void append(message_buffer& out, const char* data, size_t)
+        {
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+            std::memcpy(&storage, data, sizeof(T));
+
+            append_to(out, *reinterpret_cast<const T*>(&storage));
+        }
+    };
+
+    enum class arg_type : uint8_t
+    {
+        i64,
+        u64,
+        f64,
+        boolean,
+        character,
+        string,
+        custom
+    };
+
+    using custom_append = void(*)(message_buffer&, const char*, size_t);
+
+    // A single argument read back from a deferred payload
+    struct decoded_arg
+    {
+        arg_type      type;
+        union
+        {
+            int64_t   i64;
+            uint64_t  u64;
+            double    f64;
+            bool      boolean;
+            char_t    character;
+        };
+
+        // string: size in characters, custom: size in bytes
+        const char_t* chars;
+        const char*   bytes;
+        size_t        size;
+        custom_append append;
+    };
+
+    // Walks a deferred payload:
+    //     u32 format size, format characters, u16 argument count,
+    //     then every argument as a u8 arg_type followed by its value.
+    // A format size of compiled_format is followed by a format_string
+    // pointer instead of characters. Characters are always aligned
+    // to sizeof(char_t).
+    class deferred_reader
+    {
+    public:
+        static constexpr uint32_t compiled_format = UINT32_MAX;
+    private:
+        const char* m_data;
+        size_t      m_size;
+        size_t      m_pos;
+        size_t      m_args_left;
+    public:
+        deferred_reader(const char_t* data, size_t size)
+            : m_data(reinterpret_cast<const char*>(data)),
+              m_size(size * sizeof(char_t)),
+              m_pos(0),
+              m_args_left(0)
+        {
+        }
+
+        bool read_header(const char_t*& format, size_t& format_size, size_t& arg_count)
+        {
+            const format_string* compiled;
+
+            return read_header(format, format_size, arg_count, compiled);
+        }
+
+        // compiled is null unless the format was logged precompiled
+        bool read_header(
+            const char_t*& format,
+            size_t& format_size,
+            size_t& arg_count,
+            const format_string*& compiled
+        )
+        {
+            uint32_t size;
+            uint16_t count;
+
+            compiled = nullptr;
+
+            if (!read(size))
+                return false;
+
+            if (size == compiled_format)
+            {
+                if (!read(compiled) || !compiled)
+                    return false;
+
+                format = compiled->source();
+                size = static_cast<uint32_t>(compiled->source_size());
+            }
+            else if (!read_chars(format, size))
+                return false;
+
+            if (!read(count))
+                return false;
+
+            format_size = size;
+            arg_count = m_args_left = count;
+
+            return true;
+        }
+
+        bool read_arg(decoded_arg& arg)
+        {
+            uint8_t type;
+
+            if (!m_args_left || !read(type))
+                return false;
+
+            --m_args_left;
+
+            arg.type = static_cast<arg_type>(type);
+            arg.chars = nullptr;
+            arg.bytes = nullptr;
+            arg.size = 0;
+            arg.append = nullptr;
+
+            switch (arg.type)
+            {
+                case arg_type::i64:       return read(arg.i64);
+                case arg_type::u64:       return read(arg.u64);
+                case arg_type::f64:       return read(arg.f64);
+                case arg_type::boolean:   return read(arg.boolean);
+                case arg_type::character: return read(arg.character);
+                case arg_type::string:
+                {
+                    uint32_t size;
+
+                    if (!read(size))
+                        return false;
+
+                    arg.size = size;
+                    return read_chars(arg.chars, size);
+                }
+                case arg_type::custom:
+                {
+                    uint32_t size;
+
+                    if (!read(arg.append) || !read(size) || m_size - m_pos < size)
+                        return false;
+
+                    arg.size = size;
+                    arg.bytes = m_data + m_pos;
+                    m_pos += size;
+
+                    return true;
+                }
+                default:
+                    return false;
+            }
+        }
+    private:
+        template<typename T>
+        bool read(T& value)
+        {
+            if (m_size - m_pos < sizeof(T))
+                return false;
+
+            std::memcpy(&value, m_data + m_pos, sizeof(T));
+            m_pos += sizeof(T);
+
+            return true;
+        }
+
+        bool read_chars(const char_t*& chars, size_t count)
+        {
+            m_pos = (m_pos + sizeof(char_t) - 1) / sizeof(char_t) * sizeof(char_t);
+
+            if (m_pos > m_size || (m_size - m_pos) / sizeof(char_t) < count)
+                return false;
+
+            chars = reinterpret_cast<const char_t*>(m_data + m_pos);
+            m_pos += count * sizeof(char_t);
+
+            return true;
+        }
+    };
+
+    // Captures a format string and its arguments as raw values
+    // on the logging thread, and formats them later on. Types
+    // without a cheap raw form are formatted right away and
+    // captured as strings, so the output is always the same
+    // as formatting on the spot.
+    class deferred
+    {
+    public:
+        template<typename Buffer, typename... Args>
+        static void encode(Buffer& out, const char_t* format, size_t format_size, Args&& ... args)
+        {
+            writer<Buffer> w(out);
+
+            w.put(static_cast<uint32_t>(format_size));
+            w.put_chars(format, format_size);
+            w.put(static_cast<uint16_t>(sizeof...(Args)));
+
+            using expander = int[];
+            (void) expander { 0, (encode_arg(w, std::forward<Args>(args)), 0)... };
+        }
+
+        // Stores a pointer to format instead of its source,
+        // so format has to outlive every message logged with it
+        template<typename Buffer, typename... Args>
+        static void encode(Buffer& out, const format_string& format, Args&& ... args)
+        {
+            writer<Buffer> w(out);
+            const format_string* compiled = &format;
+
+            w.put(deferred_reader::compiled_format);
+            w.put(compiled);
+            w.put(static_cast<uint16_t>(sizeof...(Args)));
+
+            using expander = int[];
+            (void) expander { 0, (encode_arg(w, std::forward<Args>(args)), 0)... };
+        }
+
+        // Appends the formatted text of a deferred payload to out
+        static void format_to(message_buffer& out, const char_t* data, size_t size)
+        {
+            deferred_reader reader(data, size);
+
+            const char_t* format;
+            size_t format_size;
+            size_t arg_count;
+            const format_string* compiled;
+
+            if (!reader.read_header(format, format_size, arg_count, compiled))
+                return;
+
+            if (compiled)
+                format_compiled(out, *compiled, reader, arg_count);
+            else
+                format_with(out, format, format_size, reader, arg_count);
+        }
+
+        // Formats the arguments left in reader with the given format
+        // instead of the one stored in the payload
+        static void format_with(
+            message_buffer& out,
+            const char_t* format,
+            size_t format_size,
+            deferred_reader& reader,
+            size_t arg_count
+        )
+        {
+            format_cache::with(format, format_size,
+                [&](const format_string& compiled)
+                {
+                    format_compiled(out, compiled, reader, arg_count);
+                });
+        }
+
+        static void format_compiled(
+            message_buffer& out,
+            const format_string& compiled,
+            deferred_reader& reader,
+            size_t arg_count
+        )
+        {
+            thread_scratch<decoded_args, decoded_args> scratch;
+
+            auto& args = scratch->args;
+            auto& erased_args = scratch->erased_args;
+            auto& arg_slots = scratch->arg_slots;
+
+            args.resize(arg_count);
+            erased_args.resize(arg_count);
+            arg_slots.resize(arg_count);
+
+            for (size_t i = 0; i < arg_count; ++i)
+            {
+                if (!reader.read_arg(args[i]))
+                    return;
+
+                erased_args[i] = {
+                    &args[i],
+                    &append_decoded,
+                    args[i].type == arg_type::string ? args[i].size : 16
+                };
+            }
+
+            formatter::format_args_to(out, compiled, erased_args.data(), arg_slots.data(), arg_count);
+        }
+
+        // A payload with an empty format and text as its only argument
+        template<typename Buffer>
+        static void encode_text(Buffer& out, const char_t* text, size_t size)
+        {
+            writer<Buffer> w(out);
+
+            w.put(static_cast<uint32_t>(0));
+            w.put(static_cast<uint16_t>(1));
+            put_string(w, text, size);
+        }
+
+        // Copies a payload to out with an empty format, and custom
+        // arguments turned into strings so that reading it back doesn't
+        // depend on this process. format points at the original format.
+        template<typename Buffer>
+        static bool encode_portable(
+            Buffer& out,
+            const char_t* data,
+            size_t size,
+            const char_t*& format,
+            size_t& format_size
+        )
+        {
+            thread_scratch<message_buffer, portable_tag> scratch;
+
+            deferred_reader reader(data, size);
+            size_t arg_count;
+
+            if (!reader.read_header(format, format_size, arg_count))
+                return false;
+
+            writer<Buffer> w(out);
+
+            w.put(static_cast<uint32_t>(0));
+            w.put(static_cast<uint16_t>(arg_count));
+
+            decoded_arg arg;
+
+            for (size_t i = 0; i < arg_count; ++i)
+            {
+                if (!reader.read_arg(arg))
+                    return false;
+
+                switch (arg.type)
+                {
+                    case arg_type::i64:       w.put(arg.type); w.put(arg.i64);       break;
+                    case arg_type::u64:       w.put(arg.type); w.put(arg.u64);       break;
+                    case arg_type::f64:       w.put(arg.type); w.put(arg.f64);       break;
+                    case arg_type::boolean:   w.put(arg.type); w.put(arg.boolean);   break;
+                    case arg_type::character: w.put(arg.type); w.put(arg.character); break;
+                    case arg_type::string:
+                        put_string(w, arg.chars, arg.size);
+                        break;
+                    case arg_type::custom:
+                        scratch->clear();
+                        arg.append(*scratch, arg.bytes, arg.size);
+                        put_string(w, scratch->data(), scratch->size());
+                        break;
+                }
+            }
+
+            return true;
+        }
+
+        static void append_decoded(message_buffer& out, const void* value)
+        {
+            auto& arg = *static_cast<const decoded_arg*>(value);
+
+            switch (arg.type)
+            {
+                case arg_type::i64:       append_to(out, arg.i64);       break;
+                case arg_type::u64:       append_to(out, arg.u64);       break;
+                case arg_type::f64:       append_to(out, arg.f64);       break;
+                case arg_type::boolean:   append_to(out, arg.boolean);   break;
+                case arg_type::character: append_to(out, arg.character); break;
+                case arg_type::string:    out.append(arg.chars, arg.size); break;
+                case arg_type::custom:    arg.append(out, arg.bytes, arg.size); break;
+            }
+        }
+    private:
+        struct decoded_args
+        {
+            std::vector<decoded_arg>                           args;
+            std::vector<formatter::format_arg<message_buffer>> erased_args;
+            std::vector<size_t>                                arg_slots;
+        };
+
+        struct portable_tag;
+        struct insertable_tag;
+
+        template<typename Buffer>
+        class writer
+        {
+        private:
+            Buffer& m_out;
+            size_t  m_pos;
+        public:
+            writer(Buffer& out)
+                : m_out(out),
+                  m_pos(out.size() * sizeof(char_t))
+            {
+            }
+
+            template<typename T>
+            void put(const T& value)
+            {
+                std::memcpy(grow(sizeof(T)), &value, sizeof(T));
+            }
+
+            void put_chars(const char_t* chars, size_t count)
+            {
+                m_pos = (m_pos + sizeof(char_t) - 1) / sizeof(char_t) * sizeof(char_t);
+                auto* at = grow(count * sizeof(char_t));
+
+                if (count)
+                    std::memcpy(at, chars, count * sizeof(char_t));
+            }
+
+            // Room for size more bytes
+            char* grow(size_t size)
+            {
+                size_t at = m_pos;
+                m_pos += size;
+
+                m_out.resize((m_pos + sizeof(char_t) - 1) / sizeof(char_t));
+
+                return reinterpret_cast<char*>(m_out.data()) + at;
+            }
+        };
+
+        template<typename T, typename U = typename std::decay<T>::type>
+        struct capture_kind
+        {
+            static constexpr bool custom = serializer<U>::enabled;
+
+            // Everything else goes through append_to right away
+            static constexpr bool raw =
+                !custom &&
+                append_kind_of<T>::value != append_kind::insertable &&
+                !std::is_same<U, long double>::value;
+        };
+
+        template<typename Buffer, typename T>
+        static typename std::enable_if<capture_kind<T>::custom>::type
+        encode_arg(writer<Buffer>& w, T&& arg)
+        {
+            using ser = serializer<typename std::decay<T>::type>;
+
+            custom_append append = &ser::append;
+            auto size = ser::size(arg);
+
+            w.put(arg_type::custom);
+            w.put(append);
+            w.put(static_cast<uint32_t>(size));
+            ser::write(w.grow(size), arg);
+        }
+
+        template<typename Buffer, typename T>
+        static typename std::enable_if<capture_kind<T>::raw>::type
+        encode_arg(writer<Buffer>& w, T&& arg)
+        {
+            encode_raw(w, std::forward<T>(arg), append_tag<append_kind_of<T>::value>());
+        }
+
+        template<typename Buffer, typename T>
+        static typename std::enable_if<!capture_kind<T>::custom && !capture_kind<T>::raw>::type
+        encode_arg(writer<Buffer>& w, T&& arg)
+        {
+            thread_scratch<message_buffer, insertable_tag> scratch;
+
+            scratch->clear();
+            append_to(*scratch, std::forward<T>(arg));
+
+            put_string(w, scratch->data(), scratch->size());
+        }
+
+        template<typename Buffer>
+        static void put_string(writer<Buffer>& w, const char_t* chars, size_t size)
+        {
+            w.put(arg_type::string);
+            w.put(static_cast<uint32_t>(size));
+            w.put_chars(chars, size);
+        }
+
+        template<typename Buffer>
+        static void encode_raw(writer<Buffer>& w, bool arg, append_tag<append_kind::boolean>)
+        {
+            w.put(arg_type::boolean);
+            w.put(arg);
+        }
+
+        template<typename Buffer>
+        static void encode_raw(writer<Buffer>& w, char_t arg, append_tag<append_kind::character>)
+        {
+            w.put(arg_type::character);
+            w.put(arg);
+        }
+
+        template<typename Buffer, typename T>
+        static void encode_raw(writer<Buffer>& w, T arg, append_tag<append_kind::integer>)
+        {
+            if (std::is_signed<T>::value)
+            {
+                w.put(arg_type::i64);
+                w.put(static_cast<int64_t>(arg));
+            }
+            else
+            {
+                w.put(arg_type::u64);
+                w.put(static_cast<uint64_t>(arg));
+            }
+        }
+
+        // Floats print the same once widened, the value is exact
+        template<typename Buffer, typename T>
+        static void encode_raw(writer<Buffer>& w, T arg, append_tag<append_kind::floating>)
+        {
+            w.put(arg_type::f64);
+            w.put(static_cast<double>(arg));
+        }
+
+        template<typename Buffer>
+        static void encode_raw(writer<Buffer>& w, const char_t* arg, append_tag<append_kind::c_string>)
+        {
+            if (arg)
+                put_string(w, arg, BLOGGER_STRING_LENGTH(arg));
+            else
+                put_string(w, arg, 0);
+        }
+
+        template<typename Buffer>
+        static void encode_raw(writer<Buffer>& w, const string& arg, append_tag<append_kind::std_string>)
+        {
+            put_string(w, arg.data(), arg.size());
+        }
+
+      #ifdef BLOGGER_HAS_STRING_VIEW
+        template<typename Buffer>
+        static void encode_raw(writer<Buffer>& w, in_string arg, append_tag<append_kind::string_view>)
+        {
+            put_string(w, arg.data(), arg.size());
+        }
+      #endif
+    };
+}
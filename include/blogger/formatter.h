@@ -1,82 +1,763 @@
 #pragma once
 
+#include <cstdint>
+#include <ctime>
 #include <memory>
 #include <array>
 #include <string>
 #include <sstream>
 #include <vector>
 #include <mutex>
+#include <atomic>
+#include <algorithm>
 
 #include "blogger/os/functions.h"
+#include "blogger/os/clock.h"
+#include "blogger/buffer.h"
 #include "blogger/log_levels.h"
 
+// Compiles a format string literal once per call site:
+//     logger->info(BLOGGER_FORMAT("Request {} took {}ms"), id, ms);
+#define BLOGGER_FORMAT(fmt)                               \
+    ([]() -> const ::bl::format_string&                   \
+    {                                                     \
+        static const ::bl::format_string s_format(fmt);   \
+        return s_format;                                  \
+    }())
+
 namespace bl
 {
-    class formatter
+    // A log message format split into literal runs and
+    // argument slots. Compiling it once means the message
+    // is only scanned a single time no matter how many
+    // arguments there are. Keep one around as a static
+    // at hot call sites to skip compilation altogether.
+    class format_string
+    {
+    public:
+        enum class segment_type : uint8_t
+        {
+            literal,
+            positional, // {n}
+            next        // {}
+        };
+
+        struct segment
+        {
+            segment_type type;
+            uint16_t     index;
+            size_t       offset;
+            size_t       size;
+        };
+    private:
+        string               m_source;
+        std::vector<segment> m_segments;
+        std::vector<size_t>  m_slots;
+        size_t               m_literal_size;
+    public:
+        format_string()
+            : m_literal_size(0)
+        {
+        }
+
+        explicit format_string(in_string fmt)
+            : m_literal_size(0)
+        {
+            compile(fmt);
+        }
+
+        format_string(const char_t* fmt, size_t size)
+            : m_literal_size(0)
+        {
+            compile(fmt, size);
+        }
+
+        void compile(in_string fmt)
+        {
+            compile(fmt.data(), fmt.size());
+        }
+
+        void compile(const char_t* fmt, size_t size)
+        {
+            m_source.assign(fmt, size);
+            m_segments.clear();
+            m_slots.clear();
+            m_literal_size = 0;
+
+            size_t literal_begin = 0;
+            size_t pos = m_source.find(BLOGGER_WIDEN_IF_NEEDED('{'));
+
+            while (pos != string::npos)
+            {
+                size_t end = pos + 1;
+                uint32_t index = 0;
+
+                while (end < m_source.size() &&
+                       m_source[end] >= BLOGGER_WIDEN_IF_NEEDED('0') &&
+                       m_source[end] <= BLOGGER_WIDEN_IF_NEEDED('9') &&
+                       index <= UINT16_MAX)
+                {
+                    index = index * 10 + (m_source[end] - BLOGGER_WIDEN_IF_NEEDED('0'));
+                    ++end;
+                }
+
+                size_t digits = end - pos - 1;
+
+                // Only "{}" and "{n}" without leading zeroes are arguments,
+                // anything else is kept as is.
+                if (end == m_source.size() ||
+                    m_source[end] != BLOGGER_WIDEN_IF_NEEDED('}') ||
+                    index > UINT16_MAX ||
+                    (digits > 1 && m_source[pos + 1] == BLOGGER_WIDEN_IF_NEEDED('0')))
+                {
+                    pos = m_source.find(BLOGGER_WIDEN_IF_NEEDED('{'), pos + 1);
+                    continue;
+                }
+
+                add_literal(literal_begin, pos);
+
+                m_slots.push_back(m_segments.size());
+                m_segments.push_back({
+                    digits ? segment_type::positional : segment_type::next,
+                    static_cast<uint16_t>(index),
+                    pos,
+                    end + 1 - pos
+                });
+
+                literal_begin = end + 1;
+                pos = m_source.find(BLOGGER_WIDEN_IF_NEEDED('{'), literal_begin);
+            }
+
+            add_literal(literal_begin, m_source.size());
+        }
+
+        const char_t* source() const
+        {
+            return m_source.data();
+        }
+
+        size_t source_size() const
+        {
+            return m_source.size();
+        }
+
+        bool matches(const char_t* fmt, size_t size) const
+        {
+            return m_source.size() == size &&
+                   std::equal(fmt, fmt + size, m_source.data());
+        }
+
+        const std::vector<segment>& segments() const
+        {
+            return m_segments;
+        }
+
+        const std::vector<size_t>& slots() const
+        {
+            return m_slots;
+        }
+
+        size_t literal_size() const
+        {
+            return m_literal_size;
+        }
+    private:
+        void add_literal(size_t begin, size_t end)
+        {
+            if (begin == end)
+                return;
+
+            m_segments.push_back({ segment_type::literal, 0, begin, end - begin });
+            m_literal_size += end - begin;
+        }
+    };
+
+    // Format strings compiled by the current thread. Each one
+    // is compiled the first time it's logged and only compared
+    // afterwards, the same text logged from a different buffer
+    // (a deferred payload, say) still finds its entry.
+    class format_cache
+    {
+    public:
+        static constexpr size_t capacity = 64;
+    private:
+        std::array<format_string, capacity> m_entries;
+        bool                                 m_busy;
+    public:
+        format_cache()
+            : m_busy(false)
+        {
+        }
+
+        // Calls use with the compiled fmt. Nested calls on the same
+        // thread compile into a format_string of their own so that
+        // the entry in use by the outer call is never overwritten.
+        template<typename Use>
+        static void with(const char_t* fmt, size_t size, Use&& use)
+        {
+            static thread_local format_cache s_cache;
+
+            if (s_cache.m_busy)
+            {
+                format_string compiled(fmt, size);
+                use(static_cast<const format_string&>(compiled));
+                return;
+            }
+
+            struct busy_scope
+            {
+                bool& busy;
+
+                busy_scope(bool& b) : busy(b) { busy = true; }
+                ~busy_scope() { busy = false; }
+            } scope(s_cache.m_busy);
+
+            auto& entry = s_cache.m_entries[slot_of(fmt, size)];
+
+            if (!entry.matches(fmt, size))
+                entry.compile(fmt, size);
+
+            use(static_cast<const format_string&>(entry));
+        }
+    private:
+        // Hashes the size and the characters at both ends
+        static size_t slot_of(const char_t* fmt, size_t size)
+        {
+            constexpr size_t sampled = 8;
+
+            uint64_t hash = 14695981039346656037ull ^ size;
+
+            auto mix = [&hash](const char_t* begin, const char_t* end)
+            {
+                for (; begin != end; ++begin)
+                {
+                    hash ^= static_cast<uint64_t>(*begin);
+                    hash *= 1099511628211ull;
+                }
+            };
+
+            mix(fmt, fmt + std::min(size, sampled));
+
+            if (size > sampled)
+                mix(fmt + size - std::min(size - sampled, sampled), fmt + size);
+
+            return static_cast<size_t>(hash % capacity);
+        }
+    };
+
+    // A logger pattern compiled into a sequence of tokens.
+    // Rendering it is a single pass over the tokens with
+    // no searching or shifting of the output.
+    class log_pattern
     {
-        constexpr static auto arg_opening = BLOGGER_WIDEN_IF_NEEDED("{");
-        constexpr static auto arg_closing = BLOGGER_WIDEN_IF_NEEDED("}");
-        constexpr static auto arg_full    = BLOGGER_WIDEN_IF_NEEDED("{}");
+        friend class pattern_list;
+    public:
+        constexpr static auto timestamp_token    = BLOGGER_WIDEN_IF_NEEDED("{ts}");
+        constexpr static auto timestamp_ms_token = BLOGGER_WIDEN_IF_NEEDED("{ts:ms}");
+        constexpr static auto timestamp_us_token = BLOGGER_WIDEN_IF_NEEDED("{ts:us}");
+        constexpr static auto timestamp_ns_token = BLOGGER_WIDEN_IF_NEEDED("{ts:ns}");
+        constexpr static auto tag_token          = BLOGGER_WIDEN_IF_NEEDED("{tag}");
+        constexpr static auto level_token        = BLOGGER_WIDEN_IF_NEEDED("{lvl}");
+        constexpr static auto message_token      = BLOGGER_WIDEN_IF_NEEDED("{msg}");
+        constexpr static auto sequence_token     = BLOGGER_WIDEN_IF_NEEDED("{seq}");
+
+        enum class token_type : uint8_t
+        {
+            literal,
+            tag,
+            level,
+            timestamp,
+            message,
+            sequence
+        };
+
+        struct token
+        {
+            token_type type;
+            uint8_t    digits; // sub-second digits of a timestamp
+            size_t     offset;
+            size_t     size;
+        };
+    private:
+        string             m_source;
+        string             m_literals;
+        string             m_tag;
+        std::vector<token> m_tokens;
+        clock_source::ptr  m_clock;
+        uint64_t           m_version;
+
+        // Messages still pointing at this version
+        mutable std::atomic<size_t> m_references;
+
+        size_t             m_fixed_size;
+        size_t             m_timestamp_count;
+        size_t             m_level_count;
+        size_t             m_message_count;
+        size_t             m_sequence_count;
+    public:
+        log_pattern()
+            : m_clock(default_clock()),
+              m_version(0),
+              m_references(0),
+              m_fixed_size(0),
+              m_timestamp_count(0),
+              m_level_count(0),
+              m_message_count(0),
+              m_sequence_count(0)
+        {
+        }
+
+        log_pattern(
+            in_string pattern,
+            in_string tag,
+            uint64_t version = 0,
+            clock_source::ptr clock = default_clock()
+        ) : log_pattern()
+        {
+            compile(pattern, tag);
+            m_version = version;
+            m_clock = std::move(clock);
+        }
+
+        void compile(in_string pattern, in_string tag)
+        {
+            m_source.assign(pattern.data(), pattern.size());
+            m_literals.clear();
+            m_tokens.clear();
+            m_tag.assign(tag.data(), tag.size());
+            m_fixed_size = 0;
+            m_timestamp_count = 0;
+            m_level_count = 0;
+            m_message_count = 0;
+            m_sequence_count = 0;
+
+            struct token_name
+            {
+                const char_t* name;
+                token_type    type;
+                uint8_t       digits;
+            };
+
+            const token_name names[] = {
+                { tag_token,          token_type::tag,       0 },
+                { level_token,        token_type::level,     0 },
+                { timestamp_token,    token_type::timestamp, 0 },
+                { timestamp_ms_token, token_type::timestamp, 3 },
+                { timestamp_us_token, token_type::timestamp, 6 },
+                { timestamp_ns_token, token_type::timestamp, 9 },
+                { message_token,      token_type::message,   0 },
+                { sequence_token,     token_type::sequence,  0 }
+            };
+
+            size_t pos = 0;
+
+            while (pos < pattern.size())
+            {
+                auto next = pattern.find(BLOGGER_WIDEN_IF_NEEDED('{'), pos);
+                if (next == string::npos)
+                    next = pattern.size();
+
+                add_literal(pattern.data() + pos, next - pos);
+                pos = next;
+
+                if (pos == pattern.size())
+                    break;
+
+                bool matched = false;
+
+                for (auto& candidate : names)
+                {
+                    auto length = BLOGGER_STRING_LENGTH(candidate.name);
 
-        constexpr static auto timestamp_pattern = BLOGGER_WIDEN_IF_NEEDED("{ts}");
-        constexpr static auto tag_pattern       = BLOGGER_WIDEN_IF_NEEDED("{tag}");
-        constexpr static auto level_pattern     = BLOGGER_WIDEN_IF_NEEDED("{lvl}");
-        constexpr static auto message_pattern   = BLOGGER_WIDEN_IF_NEEDED("{msg}");
+                    if (pattern.compare(pos, length, candidate.name) != 0)
+                        continue;
 
+                    add_token(candidate.type, candidate.digits);
+                    pos += length;
+                    matched = true;
+                    break;
+                }
+
+                if (!matched)
+                {
+                    add_literal(pattern.data() + pos, 1);
+                    ++pos;
+                }
+            }
+        }
+
+        bool empty() const
+        {
+            return m_tokens.empty();
+        }
+
+        const std::vector<token>& tokens() const
+        {
+            return m_tokens;
+        }
+
+        const char_t* literal(const token& t) const
+        {
+            return m_literals.data() + t.offset;
+        }
+
+        const string& source() const
+        {
+            return m_source;
+        }
+
+        const string& tag() const
+        {
+            return m_tag;
+        }
+
+        uint64_t version() const
+        {
+            return m_version;
+        }
+
+        // Called by whoever got it from pattern_list::acquire()
+        void release() const
+        {
+            m_references.fetch_sub(1, std::memory_order_release);
+        }
+
+        // The clock messages using this pattern are timed with
+        const clock_source& clock() const
+        {
+            return *m_clock;
+        }
+
+        const clock_source::ptr& shared_clock() const
+        {
+            return m_clock;
+        }
+
+        // Size of everything except the formatted timestamp,
+        // the level and the message.
+        size_t fixed_size() const
+        {
+            return m_fixed_size;
+        }
+
+        size_t timestamp_count() const
+        {
+            return m_timestamp_count;
+        }
+
+        size_t level_count() const
+        {
+            return m_level_count;
+        }
+
+        size_t message_count() const
+        {
+            return m_message_count;
+        }
+
+        size_t sequence_count() const
+        {
+            return m_sequence_count;
+        }
+    private:
+        void add_literal(const char_t* data, size_t size)
+        {
+            if (!size)
+                return;
+
+            // Merge with the previous literal if possible
+            if (!m_tokens.empty() && m_tokens.back().type == token_type::literal)
+                m_tokens.back().size += size;
+            else
+                m_tokens.push_back({ token_type::literal, 0, m_literals.size(), size });
+
+            m_literals.append(data, size);
+            m_fixed_size += size;
+        }
+
+        void add_token(token_type type, uint8_t digits)
+        {
+            m_tokens.push_back({ type, digits, 0, 0 });
+
+            // The sub-second part is always the same size
+            if (digits)
+                m_fixed_size += digits + 1;
+
+            switch (type)
+            {
+                case token_type::tag:       m_fixed_size += m_tag.size(); break;
+                case token_type::level:     ++m_level_count;              break;
+                case token_type::timestamp: ++m_timestamp_count;          break;
+                case token_type::message:   ++m_message_count;            break;
+                case token_type::sequence:  ++m_sequence_count;           break;
+                default: break;
+            }
+        }
+    };
+
+    // Immutable pattern versions published by a logger.
+    // Every message holds a reference to the version it was
+    // captured with, replaced versions are freed on a later
+    // publish once no message refers to them anymore.
+    class pattern_list
+    {
+    private:
+        std::unique_ptr<const log_pattern>              m_latest;
+        std::vector<std::unique_ptr<const log_pattern>> m_retired;
+        std::atomic<const log_pattern*>                 m_current;
+
+        // Threads between loading m_current and taking a reference
+        std::atomic<size_t>                             m_acquiring;
+        std::mutex                                      m_publish_access;
+    public:
+        pattern_list()
+            : m_latest(std::make_unique<log_pattern>(BLOGGER_WIDEN_IF_NEEDED(""), BLOGGER_WIDEN_IF_NEEDED(""), next_version())),
+              m_current(nullptr),
+              m_acquiring(0)
+        {
+            m_current = m_latest.get();
+        }
+
+        pattern_list(const pattern_list& other) = delete;
+        pattern_list& operator=(const pattern_list& other) = delete;
+
+        // The current version with a reference taken,
+        // to be given back with log_pattern::release()
+        const log_pattern* acquire()
+        {
+            m_acquiring.fetch_add(1, std::memory_order_seq_cst);
+
+            auto* pattern = m_current.load(std::memory_order_seq_cst);
+            pattern->m_references.fetch_add(1, std::memory_order_relaxed);
+
+            m_acquiring.fetch_sub(1, std::memory_order_release);
+
+            return pattern;
+        }
+
+        void publish(in_string pattern, in_string tag)
+        {
+            locker lock(m_publish_access);
+            republish(pattern, tag, m_latest->m_clock);
+        }
+
+        // Republishes the current pattern with a new tag
+        void retag(in_string tag)
+        {
+            locker lock(m_publish_access);
+            republish(m_latest->source(), tag, m_latest->m_clock);
+        }
+
+        // Republishes the current pattern with a new clock
+        void set_clock(clock_source::ptr clock)
+        {
+            locker lock(m_publish_access);
+            republish(m_latest->source(), m_latest->tag(), std::move(clock));
+        }
+
+        // Versions that are still referenced by a message
+        size_t retired() const
+        {
+            return m_retired.size();
+        }
+    private:
+        void republish(in_string pattern, in_string tag, clock_source::ptr clock)
+        {
+            auto next = std::make_unique<log_pattern>(pattern, tag, next_version(), std::move(clock));
+
+            m_current.store(next.get(), std::memory_order_seq_cst);
+            m_retired.emplace_back(std::move(m_latest));
+            m_latest = std::move(next);
+
+            reclaim();
+        }
+
+        void reclaim()
+        {
+            // Someone may have loaded a retired version
+            // without having taken a reference to it yet
+            if (m_acquiring.load(std::memory_order_seq_cst))
+                return;
+
+            m_retired.erase(
+                std::remove_if(m_retired.begin(), m_retired.end(),
+                    [](const std::unique_ptr<const log_pattern>& pattern)
+                    {
+                        return pattern->m_references.load(std::memory_order_acquire) == 0;
+                    }),
+                m_retired.end()
+            );
+        }
+
+        // Unique across all loggers, so sinks can tell versions apart
+        static uint64_t next_version()
+        {
+            static std::atomic<uint64_t> s_version(0);
+            return s_version.fetch_add(1, std::memory_order_relaxed) + 1;
+        }
+    };
+
+    using shared_patterns = std::shared_ptr<pattern_list>;
+
+    class formatter
+    {
         constexpr static auto default_timestamp_format = BLOGGER_WIDEN_IF_NEEDED("%H:%M:%S");
 
         constexpr static auto default_ending  = BLOGGER_WIDEN_IF_NEEDED("\n");
         constexpr static auto default_postfix = BLOGGER_WIDEN_IF_NEEDED("...");
 
         friend class logger;
+        friend class deferred;
+        friend class binary_sink;
     public:
-        static void create_pattern_from(
-            string& out_pattern,
-            in_string tag
-        )
+        template<typename... Args>
+        static string format(in_string fmt, Args&& ... args)
         {
-            if (out_pattern.empty())
-                return;
-
-            find_and_replace(out_pattern, tag_pattern, tag);
+            string formatted;
+            format_to(formatted, fmt, std::forward<Args>(args)...);
+            return formatted;
         }
 
         template<typename... Args>
-        static string format(string pattern, Args&& ... args)
+        static string format(const format_string& fmt, Args&& ... args)
         {
-            uint16_t index = 0;
+            string formatted;
+            format_to(formatted, fmt, std::forward<Args>(args)...);
+            return formatted;
+        }
 
-            // (MSVC) ignore the E1919 here
-            BLOGGER_VA_FOR_EACH_DO(format_one, Args, args, pattern, index);
-            return pattern;
+        template<typename Buffer, typename... Args>
+        static void format_to(Buffer& out, in_string fmt, Args&& ... args)
+        {
+            format_cache::with(fmt.data(), fmt.size(),
+                [&](const format_string& compiled)
+                {
+                    format_to(out, compiled, std::forward<Args>(args)...);
+                });
+        }
+
+        // Appends the formatted message to out
+        template<typename Buffer, typename... Args>
+        static void format_to(Buffer& out, const format_string& fmt, Args&& ... args)
+        {
+            constexpr size_t arg_count = sizeof...(Args);
+
+            std::array<format_arg<Buffer>, arg_count> erased_args = {{
+                {
+                    static_cast<const void*>(std::addressof(args)),
+                    &append_erased<Buffer, typename std::remove_reference<Args>::type>,
+                    size_hint(args)
+                }...
+            }};
+            std::array<size_t, arg_count> arg_slots;
+
+            format_args_to(out, fmt, erased_args.data(), arg_slots.data(), arg_count);
         }
 
+        // time is in nanoseconds since the epoch
+        template<typename Message, typename Buffer>
         static void merge_pattern(
-            string& formatted_msg,
-            string& merge_into,
-            std::tm* time_ptr,
-            level lvl
+            const Message& formatted_msg,
+            const log_pattern& pattern,
+            int64_t time,
+            level lvl,
+            uint64_t sequence,
+            Buffer& out
         )
         {
-            find_and_replace(merge_into, message_pattern, formatted_msg);
-            find_and_replace(merge_into, timestamp_pattern, timestamp_format().c_str());
-            find_and_replace_timestamp(merge_into, timestamp_format(), time_ptr);
-            find_and_replace_level(merge_into, level_pattern, lvl);
+            constexpr int64_t ns_per_second = 1000000000;
 
-            if (max_length() != infinite &&
-                merge_into.size() > max_length()
-            )
+            // Floor division so that times before the epoch work too
+            int64_t seconds     = time / ns_per_second;
+            int64_t nanoseconds = time % ns_per_second;
+
+            if (nanoseconds < 0)
             {
-                size_t to_cut =
-                    merge_into.size() -
-                    max_length() +
-                    overflow_postfix().size();
+                nanoseconds += ns_per_second;
+                --seconds;
+            }
 
-                merge_into.resize(merge_into.size() - to_cut);
-                merge_into += overflow_postfix();
+            const char_t* timestamp = nullptr;
+            size_t timestamp_size = 0;
+
+            if (pattern.timestamp_count())
+            {
+                auto& cached = cached_timestamp(seconds);
+                timestamp = cached.text;
+                timestamp_size = cached.size;
+            }
+
+            auto*  level_name = lvl.to_string();
+            size_t level_size = pattern.level_count() ? BLOGGER_STRING_LENGTH(level_name) : 0;
+
+            char_t sequence_text[20];
+            size_t sequence_size = pattern.sequence_count() ? write_decimal(sequence_text, sequence) : 0;
+
+            size_t full_size =
+                pattern.fixed_size() +
+                pattern.timestamp_count() * timestamp_size +
+                pattern.level_count() * level_size +
+                pattern.message_count() * formatted_msg.size() +
+                pattern.sequence_count() * sequence_size;
+
+            size_t limit = full_size;
+            bool cut = max_length() != infinite && full_size > max_length();
+
+            if (cut)
+                limit = max_length() > overflow_postfix().size() ?
+                        max_length() - overflow_postfix().size() : 0;
+
+            out.clear();
+            // + 1 so that sinks can null terminate it in place
+            out.reserve(limit + (cut ? overflow_postfix().size() : 0) + ending().size() + 1);
+
+            auto put = [&out, limit](const char_t* data, size_t size)
+            {
+                if (out.size() + size > limit)
+                    size = limit - out.size();
+
+                out.append(data, size);
+            };
+
+            for (auto& t : pattern.tokens())
+            {
+                if (out.size() == limit)
+                    break;
+
+                switch (t.type)
+                {
+                    case log_pattern::token_type::literal:
+                        put(pattern.literal(t), t.size);
+                        break;
+                    case log_pattern::token_type::tag:
+                        put(pattern.tag().data(), pattern.tag().size());
+                        break;
+                    case log_pattern::token_type::level:
+                        put(level_name, level_size);
+                        break;
+                    case log_pattern::token_type::timestamp:
+                        put(timestamp, timestamp_size);
+
+                        if (t.digits)
+                        {
+                            char_t fraction[10];
+                            write_fraction(fraction, nanoseconds, t.digits);
+                            put(fraction, t.digits + 1u);
+                        }
+                        break;
+                    case log_pattern::token_type::message:
+                        put(formatted_msg.data(), formatted_msg.size());
+                        break;
+                    case log_pattern::token_type::sequence:
+                        put(sequence_text, sequence_size);
+                        break;
+                }
             }
 
-            merge_into += ending();
+            if (cut)
+                out += overflow_postfix();
+
+            out += ending();
         }
 
         static void cut_if_exceeds(
@@ -92,6 +773,7 @@ namespace bl
         static void set_timestamp_format(in_string new_format = default_timestamp_format)
         {
             timestamp_format() = new_format;
+            timestamp_generation().fetch_add(1, std::memory_order_release);
         }
 
         static void set_ending(in_string ending = default_ending)
@@ -99,69 +781,183 @@ namespace bl
             bl::formatter::ending() = ending;
         }
     private:
-        template<typename T>
-        static void find_and_replace(string& in, in_string what, T&& with)
+        // If your timestamp is longer than this
+        // then you're doing something wrong...
+        constexpr static size_t ts_size = 128;
+
+        struct timestamp_cache
+        {
+            int64_t  second;
+            uint64_t generation;
+            size_t   size;
+            char_t   text[ts_size];
+        };
+
+        // The strftime part of a timestamp only changes once a
+        // second, so every thread keeps the last one it rendered.
+        static const timestamp_cache& cached_timestamp(int64_t second)
         {
-            auto pos = in.find(what);
-            if (pos == string::npos) return;
+            static thread_local timestamp_cache cache = { INT64_MIN, 0, 0, {} };
+
+            auto generation = timestamp_generation().load(std::memory_order_acquire);
+
+            if (cache.second == second && cache.generation == generation)
+                return cache;
+
+            std::tm time_point;
+            auto as_time_t = static_cast<std::time_t>(second);
+            BLOGGER_UPDATE_TIME(time_point, as_time_t);
 
-            in.erase(pos, what.size());
-            in.insert(pos, to_string(with).c_str());
+            cache.second = second;
+            cache.generation = generation;
+            cache.size = BLOGGER_TIME_TO_STRING(cache.text, ts_size, timestamp_format().c_str(), &time_point);
+
+            return cache;
         }
 
-        static void find_and_replace_timestamp(string& in, in_string what, std::tm* time)
+        // Writes '.' followed by the first digits of nanoseconds
+        static void write_fraction(char_t* out, int64_t nanoseconds, uint8_t digits)
         {
-            auto pos = in.find(what);
-            if (pos == string::npos) return;
+            for (uint8_t i = digits; i < 9; ++i)
+                nanoseconds /= 10;
 
-            // If your timestamp is longer than this
-            // then you're doing something wrong...
-            constexpr size_t ts_size = 128;
+            out[0] = BLOGGER_WIDEN_IF_NEEDED('.');
 
-            char_t timestamp[ts_size];
+            for (uint8_t i = digits; i > 0; --i)
+            {
+                out[i] = static_cast<char_t>(BLOGGER_WIDEN_IF_NEEDED('0') + nanoseconds % 10);
+                nanoseconds /= 10;
+            }
+        }
 
-            auto written = BLOGGER_TIME_TO_STRING(timestamp, ts_size, timestamp_format().c_str(), time);
+        // Writes value in decimal, returns the digit count
+        static size_t write_decimal(char_t* out, uint64_t value)
+        {
+            char_t reversed[20];
+            size_t size = 0;
 
-            in.erase(pos, timestamp_format().size());
+            do
+            {
+                reversed[size++] = static_cast<char_t>(BLOGGER_WIDEN_IF_NEEDED('0') + value % 10);
+                value /= 10;
+            } while (value);
 
-            if (!written) return;
+            for (size_t i = 0; i < size; ++i)
+                out[i] = reversed[size - i - 1];
 
-            in.insert(pos, timestamp);
+            return size;
         }
 
-        static void find_and_replace_level(string& in, in_string what, level lvl)
+        static std::atomic<uint64_t>& timestamp_generation()
         {
-            auto pos = in.find(what);
-            if (pos == string::npos) return;
-
-            in.erase(pos, what.size());
-            in.insert(pos, lvl.to_string());
+            static std::atomic<uint64_t> s_generation(0);
+            return s_generation;
         }
 
-        template<typename T>
-        static void format_one(string& out_formatted, uint16_t& index, T&& arg)
+        template<typename Buffer>
+        struct format_arg
         {
-            string stringed_arg = to_string(arg);
+            const void* value;
+            void (*append)(Buffer&, const void*);
+            size_t size_hint;
+        };
+
+        // arg_slots is scratch space for arg_count indices
+        template<typename Buffer>
+        static void format_args_to(
+            Buffer& out,
+            const format_string& fmt,
+            const format_arg<Buffer>* erased_args,
+            size_t* arg_slots,
+            size_t arg_count
+        )
+        {
+            constexpr size_t no_slot = static_cast<size_t>(-1);
 
-            string pos_arg;
-            pos_arg += arg_opening;
-            pos_arg += to_string(index);
-            pos_arg += arg_closing;
+            auto& segments = fmt.segments();
+            auto& slots = fmt.slots();
+
+            // Every argument takes the first "{n}" where n is the
+            // number of arguments placed so far, or the next free "{}".
+            uint16_t index = 0;
+            size_t next_slot = 0;
+            size_t total_size = fmt.literal_size();
 
-            auto arg_offset = out_formatted.find(pos_arg);
-            if (arg_offset == string::npos)
+            for (size_t i = 0; i < arg_count; ++i)
             {
-                arg_offset = out_formatted.find(arg_full);
-                pos_arg = arg_full;
+                arg_slots[i] = no_slot;
+
+                for (auto slot : slots)
+                {
+                    if (segments[slot].type == format_string::segment_type::positional &&
+                        segments[slot].index == index)
+                    {
+                        arg_slots[i] = slot;
+                        break;
+                    }
+                }
+
+                while (arg_slots[i] == no_slot && next_slot < slots.size())
+                {
+                    auto slot = slots[next_slot++];
+
+                    if (segments[slot].type == format_string::segment_type::next)
+                        arg_slots[i] = slot;
+                }
+
+                if (arg_slots[i] == no_slot)
+                    continue;
+
+                ++index;
+                total_size += erased_args[i].size_hint;
             }
-            if (arg_offset == string::npos)
-                return;
 
-            index++;
+            out.reserve(out.size() + total_size);
+
+            for (size_t i = 0; i < segments.size(); ++i)
+            {
+                auto& seg = segments[i];
+
+                if (seg.type != format_string::segment_type::literal)
+                {
+                    size_t arg = 0;
+                    while (arg < arg_count && arg_slots[arg] != i)
+                        ++arg;
+
+                    if (arg != arg_count)
+                    {
+                        erased_args[arg].append(out, erased_args[arg].value);
+                        continue;
+                    }
+                }
+
+                out.append(fmt.source() + seg.offset, seg.size);
+            }
+        }
+
+        template<typename Buffer, typename T>
+        static void append_erased(Buffer& out, const void* value)
+        {
+            append_to(out, *const_cast<T*>(static_cast<const T*>(value)));
+        }
+
+        template<typename T>
+        static size_t size_hint(const T&)
+        {
+            return 16;
+        }
+
+        static size_t size_hint(const string& arg)
+        {
+            return arg.size();
+        }
 
-            out_formatted.erase(arg_offset, pos_arg.size());
-            out_formatted.insert(arg_offset, stringed_arg.c_str());
+      #ifdef BLOGGER_HAS_STRING_VIEW
+        static size_t size_hint(in_string arg)
+        {
+            return arg.size();
         }
+      #endif
 
         static string& overflow_postfix()
         {
@@ -6,14 +6,19 @@
 #include <atomic>
 
 #include <vector>
-#include <deque>
 
 #include <functional>
 #include <memory>
 
 #include "blogger/core.h"
 #include "blogger/loggers/logger.h"
+#include "blogger/loggers/task.h"
+#include "blogger/loggers/ring_buffer.h"
+#include "blogger/loggers/per_thread_backend.h"
 #include "blogger/sinks/file_sink.h"
+#include "blogger/sinks/binary_sink.h"
+#include "blogger/sinks/shared_sink.h"
+#include "blogger/sinks/routing_file_sink.h"
 #include "blogger/sinks/console_sink.h"
 #include "blogger/sinks/colored_console_sink.h"
 #include "blogger/log_levels.h"
@@ -21,89 +26,50 @@
 // Probably shouldnt be higher than 4 because the thread_pool
 // threads will spend most of the time waiting
 // for the I/O mutex anyway. Unless you're posting your own tasks.
+// hardware_concurrency() may be 0, the pool still gets a thread then.
 #define BLOGGER_THREAD_COUNT std::thread::hardware_concurrency()
 
-#define BLOGGER_TASK_LIMIT 10000
+// Size of the preallocated task queue, rounded up
+// to a power of two. Once it's full the overflow policy
+// of the logger posting a message decides what happens.
+#ifndef BLOGGER_TASK_LIMIT
+    #define BLOGGER_TASK_LIMIT 10000
+#endif
 
-namespace bl {
-
-    // You can make your own tasks
-    // and feed them to the thread_pool
-    // as well.
-    class task
-    {
-    public:
-        virtual void complete() = 0;
-
-        virtual ~task() = default;
-    };
-
-    class bl_task : public task
-    {
-    protected:
-        shared_sinks log_sinks;
-    protected:
-        bl_task(shared_sinks& sinks)
-            : log_sinks(sinks)
-        {
-        }
-    };
+// Messages every async logger can have in flight at once,
+// rounded up to a power of two. They're allocated along with
+// the logger, once they're all taken new messages are dropped.
+#ifndef BLOGGER_MESSAGE_SLOTS
+    #define BLOGGER_MESSAGE_SLOTS 1024
+#endif
 
-    class log_task : public bl_task
-    {
-    private:
-        log_message msg;
-    public:
-        log_task(
-            log_message&& msg,
-            shared_sinks& sinks
-        ) : bl_task(sinks),
-            msg(std::move(msg))
-        {
-        }
-
-        void complete() override
-        {
-            msg.finalize_format();
-
-            for (auto& sink : *log_sinks)
-            {
-                sink->write(msg);
-            }
-        }
-    };
-
-    class flush_task : public bl_task
-    {
-    public:
-        flush_task(shared_sinks& sinks)
-            : bl_task(sinks)
-        {
-        }
-
-        void complete() override
-        {
-            for (auto& sink : *log_sinks)
-            {
-                sink->flush();
-            }
-        }
-    };
+namespace bl {
 
-    class thread_pool
+    // An ordered pool has a single thread, so tasks are completed
+    // in the exact order they were posted in, and get numbered.
+    class thread_pool : public async_backend
     {
-    public:
-        using task_ptr = std::unique_ptr<task>;
     private:
         std::vector<std::thread> m_pool;
-        std::deque<task_ptr>     m_task_queue;
-        std::mutex               m_queue_access;
+        ring_buffer<task_ptr>    m_task_queue;
+        std::mutex               m_sleep_access;
         std::condition_variable  m_notifier;
+        std::atomic<size_t>      m_sleeping;
         std::atomic_bool         m_running;
-    private:
-        thread_pool(uint16_t thread_count)
-            : m_running(true)
+        bool                     m_ordered;
+        uint64_t                 m_next_sequence;
+    public:
+        // Never less than one thread
+        thread_pool(uint16_t thread_count, size_t capacity, bool ordered = false)
+            : m_task_queue(capacity),
+              m_sleeping(0),
+              m_running(true),
+              m_ordered(ordered),
+              m_next_sequence(0)
         {
+            if (ordered || !thread_count)
+                thread_count = 1;
+
             m_pool.reserve(thread_count);
 
             for (uint16_t i = 0; i < thread_count; i++)
@@ -115,42 +81,59 @@ namespace bl {
 
         thread_pool& operator=(const thread_pool& other) = delete;
         thread_pool& operator=(thread_pool&& other) = delete;
+    private:
 
         void worker()
         {
             bool did_work = true;
-            std::mutex worker_lock;
-            std::unique_lock<std::mutex> task_waiter(worker_lock);
+            std::unique_lock<std::mutex> task_waiter(m_sleep_access);
+            task_waiter.unlock();
+
+            // Only the one worker of an ordered pool ever touches it
+            task_batch batch(
+                task_batch::default_capacity,
+                m_ordered ? &m_next_sequence : nullptr
+            );
 
             while (m_running || did_work)
             {
                 if (!did_work)
-                    m_notifier.wait_for(
-                        task_waiter,
-                        std::chrono::seconds(5)
-                    );
+                {
+                    task_waiter.lock();
+                    m_sleeping.fetch_add(1);
+
+                    // Pairs with the fence in post_task: either we see
+                    // the new task here or the producer sees us sleeping.
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                    // The timeout only matters if a wakeup races
+                    // with us going to sleep, producers never lock.
+                    if (m_task_queue.empty() && m_running)
+                        m_notifier.wait_for(
+                            task_waiter,
+                            std::chrono::milliseconds(100)
+                        );
+
+                    m_sleeping.fetch_sub(1);
+                    task_waiter.unlock();
+                }
 
-                did_work = do_work();
+                did_work = do_work(batch);
             }
         }
 
-        bool do_work()
+        // Drains up to a batch worth of tasks at once
+        bool do_work(task_batch& batch)
         {
             task_ptr p;
 
-            {
-                locker lock(m_queue_access);
+            while (!batch.full() && m_task_queue.try_pop(p))
+                batch.push(std::move(p));
 
-                if (!m_task_queue.empty())
-                {
-                    p = std::move(m_task_queue.front());
-                    m_task_queue.pop_front();
-                }
-                else
-                    return false;
-            }
+            if (batch.empty())
+                return false;
 
-            p->complete();
+            batch.run();
 
             return true;
         }
@@ -168,24 +151,32 @@ namespace bl {
         static thread_pool& get()
         {
             static thread_pool instance(
-                BLOGGER_THREAD_COUNT
+                BLOGGER_THREAD_COUNT,
+                BLOGGER_TASK_LIMIT
             );
 
             return instance;
         }
 
-        void post_task(std::unique_ptr<task> t)
+        // Never blocks and never takes a lock. Once the queue is
+        // full it's up to whoever posted what happens to t, tasks
+        // of other loggers are never dropped to make room.
+        bool try_post_task(task_ptr& t) override
         {
-            {
-                locker lock(m_queue_access);
+            if (!m_task_queue.try_push(t))
+                return false;
 
-                if (m_task_queue.size() == BLOGGER_TASK_LIMIT)
-                    m_task_queue.pop_front();
+            std::atomic_thread_fence(std::memory_order_seq_cst);
 
-                m_task_queue.emplace_back(std::move(t));
-            }
+            if (m_sleeping.load(std::memory_order_relaxed))
+                m_notifier.notify_one();
 
-            m_notifier.notify_one();
+            return true;
+        }
+
+        size_t capacity() const
+        {
+            return m_task_queue.capacity();
         }
 
         ~thread_pool()
@@ -196,33 +187,297 @@ namespace bl {
 
     class async_logger : public logger
     {
+    private:
+        using time_point = std::chrono::steady_clock::time_point;
+
+        // Only set for modes that need a backend of their own
+        std::unique_ptr<async_backend> m_own_backend;
+        async_backend*                 m_backend;
+
+        // overflow_options, field by field so that they
+        // can be changed while other threads are logging
+        std::atomic<overflow_policy>   m_policy;
+        std::atomic<size_t>            m_queue_limit;
+        std::atomic<int64_t>           m_block_timeout;
+        std::atomic<int64_t>           m_report_interval;
+
+        queue_accounting               m_accounting;
+        message_slots                  m_slots;
+        std::atomic<int64_t>           m_last_report;
     public:
         async_logger(
             in_string tag,
             level lvl,
-            bool default_pattern = true
-        ): logger(tag, lvl, default_pattern)
+            bool default_pattern = true,
+            logging_mode mode = logging_mode::async
+        ): logger(tag, lvl, default_pattern),
+           m_own_backend(),
+           m_backend(nullptr),
+           m_policy(),
+           m_queue_limit(),
+           m_block_timeout(),
+           m_report_interval(),
+           m_accounting(),
+           m_slots(BLOGGER_MESSAGE_SLOTS),
+           m_last_report(0)
         {
-            thread_pool::get();
+            set_overflow_policy(overflow_options());
+
+            if (mode == logging_mode::async_ordered)
+            {
+                m_own_backend.reset(new thread_pool(1, BLOGGER_TASK_LIMIT, true));
+                m_backend = m_own_backend.get();
+            }
+            else if (mode == logging_mode::async_per_thread)
+                m_backend = &per_thread_backend::get();
+            else
+                m_backend = &thread_pool::get();
         }
 
+        // Waits for a free slot and room in the backend
+        // rather than dropping the flush
         void flush() override
         {
-            thread_pool::get().post_task(
-                std::make_unique<flush_task>(m_sinks)
-            );
+            log_task* t;
+
+            while (!(t = m_slots.try_take()))
+                std::this_thread::yield();
+
+            t->reset_flush(*m_sinks, &m_accounting);
+            m_slots.queue(*t);
+
+            async_backend::task_ptr flush(t);
+
+            while (!m_backend->try_post_task(flush))
+                std::this_thread::yield();
+        }
+
+        // May be called while other threads are logging,
+        // each message sees every field either old or new
+        void set_overflow_policy(const overflow_options& options) override
+        {
+            m_policy.store(options.policy, std::memory_order_relaxed);
+            m_queue_limit.store(options.queue_limit, std::memory_order_relaxed);
+            m_block_timeout.store(options.block_timeout.count(), std::memory_order_relaxed);
+            m_report_interval.store(options.report_interval.count(), std::memory_order_relaxed);
+        }
+
+        // May be called while other threads are logging
+        void set_deferred_formatting(bool enabled) override
+        {
+            m_deferred.store(enabled, std::memory_order_relaxed);
+        }
+
+        uint64_t dropped_messages() const override
+        {
+            return m_accounting.dropped.load(std::memory_order_relaxed);
         }
 
-        ~async_logger() {}
+        // Waits for every task still referring to us
+        ~async_logger()
+        {
+            while (m_accounting.queued.load(std::memory_order_acquire))
+                std::this_thread::yield();
+        }
     private:
         void post(log_message&& msg) override
         {
-            thread_pool::get().post_task(
-                std::make_unique<log_task>(std::move(msg), m_sinks)
-            );
+            auto policy = m_policy.load(std::memory_order_relaxed);
+            time_point deadline;
+
+            auto* t = take_slot(msg.log_level(), policy, deadline);
+
+            if (t)
+            {
+                bool keep = never_dropped(msg.log_level(), policy);
+
+                t->reset(std::move(msg), *m_sinks, &m_accounting);
+                m_slots.queue(*t);
+
+                submit(async_backend::task_ptr(t), policy, keep, deadline);
+            }
+            else
+                m_accounting.drop();
+
+            if (m_accounting.unreported.load(std::memory_order_relaxed))
+                report_dropped();
+        }
+
+        // A slot for a new message of this level, or nullptr if
+        // the policy says to drop it. Only ever evicts our own messages.
+        log_task* take_slot(level lvl, overflow_policy policy, time_point& deadline)
+        {
+            size_t limit = queue_limit(policy);
+
+            for (;;)
+            {
+                size_t live = m_accounting.live();
+                bool room = live < limit;
+
+                switch (policy)
+                {
+                    case overflow_policy::drop_newest:
+                        if (!room)
+                            return nullptr;
+                        break;
+                    case overflow_policy::drop_oldest:
+                        if (!room)
+                        {
+                            // Counted first, its release may come right after
+                            m_accounting.cancelled.fetch_add(1, std::memory_order_relaxed);
+
+                            if (!m_slots.cancel_oldest())
+                                m_accounting.cancelled.fetch_sub(1, std::memory_order_relaxed);
+
+                            room = true;
+                        }
+                        break;
+                    case overflow_policy::drop_by_level:
+                        if (!fits_level(lvl, live, limit))
+                            return nullptr;
+                        room = true;
+                        break;
+                    default:
+                        break;
+                }
+
+                if (room)
+                {
+                    if (auto* t = m_slots.try_take())
+                        return t;
+                }
+
+                // Every slot is taken, cancelled messages included
+                if (never_dropped(lvl, policy))
+                    std::this_thread::yield();
+                else if (policy != overflow_policy::block || !keep_waiting(deadline))
+                    return nullptr;
+            }
+        }
+
+        // Hands t to the backend. If the backend's own queue is full
+        // t is released unwritten and counted as dropped, unless the
+        // policy is to block and room turns up in time, or t is never
+        // to be dropped and waits for room like a flush does.
+        void submit(async_backend::task_ptr t, overflow_policy policy, bool keep, time_point& deadline)
+        {
+            while (!m_backend->try_post_task(t))
+            {
+                if (keep)
+                    std::this_thread::yield();
+                else if (policy != overflow_policy::block || !keep_waiting(deadline))
+                    return;
+            }
+        }
+
+        // Messages that may be waiting to be written at once
+        size_t queue_limit(overflow_policy policy)
+        {
+            size_t slots = m_slots.capacity();
+            size_t limit = m_queue_limit.load(std::memory_order_relaxed);
+
+            // Cancelled messages keep their slot until the backend
+            // gets to them, so a quarter of the slots are left for them
+            if (policy == overflow_policy::drop_oldest)
+                slots -= slots / 4;
+
+            return limit == infinite || limit > slots ? slots : limit;
+        }
+
+        // Starts the clock on the first call
+        bool keep_waiting(time_point& deadline)
+        {
+            auto now = std::chrono::steady_clock::now();
+
+            if (deadline == time_point())
+                deadline = now + std::chrono::milliseconds(m_block_timeout.load(std::memory_order_relaxed));
+            else if (now >= deadline)
+                return false;
+
+            std::this_thread::yield();
+
+            return true;
+        }
+
+        static bool fits_level(level lvl, size_t queued, size_t limit)
+        {
+            const level::type droppable[] = {
+                level::trace,
+                level::debug,
+                level::info,
+                level::warn,
+                level::error
+            };
+
+            // Trace fills up to 3/8 of the queue, debug to 4/8 and so
+            // on up to 7/8 for errors, the rest is kept for critical ones
+            for (size_t i = 0; i < 5; ++i)
+            {
+                if (lvl == droppable[i])
+                    return queued * 8 < limit * (3 + i);
+            }
+
+            return true;
+        }
+
+        // Waits for a slot and for room in the backend instead
+        static bool never_dropped(level lvl, overflow_policy policy)
+        {
+            return policy == overflow_policy::drop_by_level && lvl == level::crit;
+        }
+
+        void report_dropped()
+        {
+            auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()
+            ).count();
+
+            auto last = m_last_report.load(std::memory_order_relaxed);
+            auto interval = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::milliseconds(m_report_interval.load(std::memory_order_relaxed))
+            ).count();
+
+            if (now - last < interval)
+                return;
+
+            // Someone else is reporting
+            if (!m_last_report.compare_exchange_strong(last, now, std::memory_order_relaxed))
+                return;
+
+            auto count = m_accounting.unreported.exchange(0, std::memory_order_relaxed);
+
+            if (!count)
+                return;
+
+            auto* pattern = m_patterns->acquire();
+            log_message msg(pattern, pattern->clock().now(), level::warn);
+
+            if (pattern->empty())
+                return;
+
+            auto* t = m_slots.try_take();
+
+            // Try again next time
+            if (!t)
+            {
+                m_accounting.unreported.fetch_add(count, std::memory_order_relaxed);
+                return;
+            }
+
+            formatter::format_to(msg.payload(), BLOGGER_WIDEN_IF_NEEDED("{} messages dropped"), count);
+
+            t->reset(std::move(msg), *m_sinks, &m_accounting);
+            m_slots.queue(*t);
+
+            async_backend::task_ptr report(t);
+
+            // Counts itself as dropped if it doesn't fit either
+            if (!m_backend->try_post_task(report))
+                m_accounting.unreported.fetch_add(count, std::memory_order_relaxed);
         }
     };
 }
 
 #undef BLOGGER_THREAD_COUNT
 #undef BLOGGER_TASK_LIMIT
+#undef BLOGGER_MESSAGE_SLOTS
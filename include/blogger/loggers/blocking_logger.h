@@ -27,8 +27,6 @@ namespace bl {
     private:
         void post(log_message&& msg) override
         {
-            msg.finalize_format();
-
             for (auto& sink : *m_sinks)
             {
                 sink->write(msg);
@@ -1,58 +1,192 @@
 #pragma once
 
 #include "blogger/formatter.h"
+#include "blogger/deferred.h"
 #include "blogger/log_levels.h"
 
 namespace bl {
 
+    // Holds a reference to its pattern version,
+    // which it gives back once it's destroyed.
     struct log_message
     {
     private:
-        string  m_formatted_msg;
-        string  m_final_pattern;
-        std::tm m_time_point;
-        level   m_level;
+        message_buffer     m_formatted_msg;
+        const log_pattern* m_pattern;
+        message_buffer     m_final_msg;
+        uint64_t           m_ticks;
+        uint64_t           m_sequence;
+        level              m_level;
+        bool               m_deferred;
+
+        // m_final_msg is up to date
+        bool               m_rendered;
     public:
+        // Takes over a reference from pattern_list::acquire()
         log_message(
-            string&& formatted_msg,
-            string&& ptrn,
-            std::tm tp,
+            const log_pattern* ptrn,
+            uint64_t ticks,
             level lvl
-        ) : m_formatted_msg(std::move(formatted_msg)),
-            m_final_pattern(std::move(ptrn)),
-            m_time_point(tp),
-            m_level(lvl)
+        ) : m_formatted_msg(),
+            m_pattern(ptrn),
+            m_final_msg(),
+            m_ticks(ticks),
+            m_sequence(0),
+            m_level(lvl),
+            m_deferred(false),
+            m_rendered(false)
+        {
+        }
+
+        log_message(const log_message& other) = delete;
+        log_message& operator=(const log_message& other) = delete;
+
+        log_message(log_message&& other) noexcept
+            : m_formatted_msg(std::move(other.m_formatted_msg)),
+              m_pattern(other.m_pattern),
+              m_final_msg(std::move(other.m_final_msg)),
+              m_ticks(other.m_ticks),
+              m_sequence(other.m_sequence),
+              m_level(other.m_level),
+              m_deferred(other.m_deferred),
+              m_rendered(other.m_rendered)
+        {
+            other.m_pattern = nullptr;
+        }
+
+        log_message& operator=(log_message&& other) noexcept
+        {
+            if (this == &other)
+                return *this;
+
+            release_pattern();
+
+            m_formatted_msg = std::move(other.m_formatted_msg);
+            m_pattern       = other.m_pattern;
+            m_final_msg     = std::move(other.m_final_msg);
+            m_ticks         = other.m_ticks;
+            m_sequence      = other.m_sequence;
+            m_level         = other.m_level;
+            m_deferred      = other.m_deferred;
+            m_rendered      = other.m_rendered;
+
+            other.m_pattern = nullptr;
+
+            return *this;
+        }
+
+        ~log_message()
         {
+            release_pattern();
         }
 
+        // Lets go of the pattern early, for messages that are kept around
+        void release_pattern()
+        {
+            if (m_pattern)
+                m_pattern->release();
+
+            m_pattern = nullptr;
+        }
+
+        // Renders the text sinks get through data() and size(),
+        // which call it on their own the first time they're used
         void finalize_format()
         {
-            formatter::merge_pattern(
-                m_formatted_msg,
-                m_final_pattern,
-                time_point_ptr(),
-                m_level
-            );
+            m_rendered = true;
+
+            if (m_deferred)
+            {
+                thread_scratch<message_buffer, log_message> text;
+
+                text->clear();
+                deferred::format_to(*text, m_formatted_msg.data(), m_formatted_msg.size());
+
+                merge(*text);
+            }
+            else
+                merge(m_formatted_msg);
+        }
+
+        // The message before the pattern is applied,
+        // or its encoded arguments if it's deferred
+        message_buffer& payload()
+        {
+            return m_formatted_msg;
+        }
+
+        // Payload holds a deferred format string and arguments
+        void set_deferred()
+        {
+            m_deferred = true;
+        }
+
+        bool is_deferred()
+        {
+            return m_deferred;
         }
 
         const char_t* data()
         {
-            return m_final_pattern.data();
+            if (!m_rendered)
+                finalize_format();
+
+            return m_final_msg.c_str();
         }
 
         size_t size()
         {
-            return m_final_pattern.size();
+            if (!m_rendered)
+                finalize_format();
+
+            return m_final_msg.size();
         }
 
         level log_level()
         {
             return m_level;
         }
+
+        const log_pattern& pattern()
+        {
+            return *m_pattern;
+        }
+
+        // Raw ticks of the pattern's clock
+        uint64_t ticks()
+        {
+            return m_ticks;
+        }
+
+        // Position in the logger's output, only
+        // assigned by ordered backends
+        uint64_t sequence()
+        {
+            return m_sequence;
+        }
+
+        // Has to be set before the message is rendered
+        void set_sequence(uint64_t sequence)
+        {
+            m_sequence = sequence;
+        }
+
+        // Nanoseconds since the epoch
+        int64_t time_point()
+        {
+            return m_pattern->clock().to_nanoseconds(m_ticks);
+        }
     private:
-        std::tm* time_point_ptr()
+        void merge(const message_buffer& text)
         {
-            return &m_time_point;
+            formatter::merge_pattern(
+                text,
+                *m_pattern,
+                time_point(),
+                m_level,
+                m_sequence,
+                m_final_msg
+            );
         }
     };
 }
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <ctime>
+#include <chrono>
+#include <atomic>
 
 #include "blogger/formatter.h"
 #include "blogger/loggers/log_message.h"
@@ -30,14 +32,69 @@ namespace bl {
     template<typename T, typename... Args>
     using enable_if_sink_ptr_t = typename std::enable_if<are_all_true<is_sink_ptr<Args>...>::value, T>::type;
 
+    // How a logger hands its messages to the sinks
+    enum class logging_mode
+    {
+        // On the calling thread
+        blocking,
+
+        // Through the shared thread pool, in no particular order
+        async,
+
+        // Through a per thread queue, merged by time point
+        // on a single backend thread
+        async_per_thread,
+
+        // Through a backend thread of the logger's own,
+        // in the exact order messages were posted in
+        async_ordered
+    };
+
+    // What an async logger does with a new message once it has
+    // queue_limit messages in flight, or the backend's queue is full
+    enum class overflow_policy
+    {
+        // Wait up to block_timeout for room, then drop it
+        block,
+
+        // Drop the new message
+        drop_newest,
+
+        // Drop the oldest message of this logger still in flight.
+        // When the backend's queue is full the new one goes instead.
+        drop_oldest,
+
+        // Start dropping the lowest levels as the queue fills up.
+        // Trace goes at 3/8 full, each next level an eighth later,
+        // errors at 7/8. The last eighth is kept for critical messages,
+        // which wait for room rather than ever being dropped.
+        drop_by_level
+    };
+
+    struct overflow_options
+    {
+        overflow_policy policy = overflow_policy::drop_oldest;
+
+        // Messages in flight per logger, never more
+        // than its slots (see BLOGGER_MESSAGE_SLOTS)
+        size_t queue_limit = infinite;
+
+        std::chrono::milliseconds block_timeout = std::chrono::milliseconds(10);
+
+        // How often at most the "N messages dropped" line is logged
+        std::chrono::milliseconds report_interval = std::chrono::milliseconds(1000);
+    };
+
     class logger
     {
     protected:
-        string         m_tag;
-        string         m_current_pattern;
-        string         m_cached_pattern;
-        shared_sinks   m_sinks;
-        level          m_filter;
+        string          m_tag;
+        shared_patterns m_patterns;
+        shared_sinks    m_sinks;
+        level           m_filter;
+
+        // Capture raw arguments and format them in finalize_format()
+        std::atomic<bool> m_deferred;
     public:
         static auto constexpr default_pattern = BLOGGER_WIDEN_IF_NEEDED("[{ts}][{lvl}][{tag}] {msg}");
         static auto constexpr default_tag     = BLOGGER_WIDEN_IF_NEEDED("Unnamed");
@@ -49,9 +106,10 @@ namespace bl {
             level lvl,
             bool default_pattern
         ) : m_tag(tag),
-            m_cached_pattern(),
+            m_patterns(std::make_shared<pattern_list>()),
             m_sinks(std::make_shared<sinks>()),
-            m_filter(lvl)
+            m_filter(lvl),
+            m_deferred(false)
         {
             // 'magic statics'
             global_console_write_lock();
@@ -80,6 +138,15 @@ namespace bl {
             Sinks... sinks
         );
 
+        template<typename... Sinks>
+        static enable_if_sink_ptr_t<ptr, Sinks...> make_custom(
+            in_string tag,
+            level lvl,
+            in_string pattern,
+            logging_mode mode,
+            Sinks... sinks
+        );
+
         static ptr make_async_console(
             in_string tag = default_tag,
             level lvl = level::info,
@@ -101,7 +168,8 @@ namespace bl {
             in_string directory_path = default_path,
             size_t bytes_per_file = infinite,
             size_t max_log_files = infinite,
-            bool rotate_logs = true
+            bool rotate_logs = true,
+            const file_options& options = file_options()
         );
 
         static ptr make_async_file(
@@ -111,33 +179,54 @@ namespace bl {
             in_string directory_path = default_path,
             size_t bytes_per_file = infinite,
             size_t max_log_files = infinite,
-            bool rotate_logs = true
+            bool rotate_logs = true,
+            const file_options& options = file_options()
         );
 
         void set_pattern(in_string pattern)
         {
-            m_cached_pattern = pattern;
-            m_current_pattern = m_cached_pattern;
-            formatter::create_pattern_from(m_current_pattern, m_tag);
+            m_patterns->publish(pattern, m_tag);
+        }
+
+        // Sets the clock message time points are captured with
+        void set_clock(clock_source::ptr clock)
+        {
+            m_patterns->set_clock(std::move(clock));
         }
 
         virtual void flush() = 0;
 
+        // Only affects async loggers, blocking ones never drop
+        virtual void set_overflow_policy(const overflow_options&)
+        {
+        }
+
+        // Only affects async loggers. When on, numbers, characters
+        // and strings are copied as is and formatted on the backend.
+        // A format_string logged this way has to outlive the message.
+        virtual void set_deferred_formatting(bool)
+        {
+        }
+
+        // Messages dropped since the logger was created
+        virtual uint64_t dropped_messages() const
+        {
+            return 0;
+        }
+
         void log(level lvl, in_string message)
         {
             if (!should_log(lvl))
                 return;
 
-            std::tm time_point;
-            auto time_now = std::time(nullptr);
-            BLOGGER_UPDATE_TIME(time_point, time_now);
+            auto* pattern = m_patterns->acquire();
+            log_message msg(pattern, pattern->clock().now(), lvl);
 
-            post({
-                string(message.data()),
-                m_current_pattern.data(),
-                time_point,
-                lvl
-            });
+            if (pattern->empty())
+                return;
+            msg.payload().append(message.data(), message.size());
+
+            post(std::move(msg));
         }
 
         template<typename... Args>
@@ -146,16 +235,44 @@ namespace bl {
             if (!should_log(lvl))
                 return;
 
-            std::tm time_point;
-            auto time_now = std::time(nullptr);
-            BLOGGER_UPDATE_TIME(time_point, time_now);
+            auto* pattern = m_patterns->acquire();
+            log_message msg(pattern, pattern->clock().now(), lvl);
+
+            if (pattern->empty())
+                return;
+
+            if (m_deferred.load(std::memory_order_relaxed))
+            {
+                deferred::encode(msg.payload(), formatted_msg.data(), formatted_msg.size(), std::forward<Args>(args)...);
+                msg.set_deferred();
+            }
+            else
+                formatter::format_to(msg.payload(), formatted_msg, std::forward<Args>(args)...);
 
-            post({
-                formatter::format(formatted_msg.data(), std::forward<Args>(args)...),
-                m_current_pattern.data(),
-                time_point,
-                lvl
-            });
+            post(std::move(msg));
+        }
+
+        template<typename... Args>
+        enable_if_ostream_insertable_t<Args...> log(level lvl, const format_string& formatted_msg, Args&& ... args)
+        {
+            if (!should_log(lvl))
+                return;
+
+            auto* pattern = m_patterns->acquire();
+            log_message msg(pattern, pattern->clock().now(), lvl);
+
+            if (pattern->empty())
+                return;
+
+            if (m_deferred.load(std::memory_order_relaxed))
+            {
+                deferred::encode(msg.payload(), formatted_msg, std::forward<Args>(args)...);
+                msg.set_deferred();
+            }
+            else
+                formatter::format_to(msg.payload(), formatted_msg, std::forward<Args>(args)...);
+
+            post(std::move(msg));
         }
 
        void trace(in_string message)
@@ -224,6 +341,42 @@ namespace bl {
             log(level::crit, formatted_msg, std::forward<Args>(args)...);
         }
 
+        template<typename... Args>
+        enable_if_ostream_insertable_t<Args...> trace(const format_string& formatted_msg, Args&& ... args)
+        {
+            log(level::trace, formatted_msg, std::forward<Args>(args)...);
+        }
+
+        template<typename... Args>
+        enable_if_ostream_insertable_t<Args...> debug(const format_string& formatted_msg, Args&& ... args)
+        {
+            log(level::debug, formatted_msg, std::forward<Args>(args)...);
+        }
+
+        template<typename... Args>
+        enable_if_ostream_insertable_t<Args...> info(const format_string& formatted_msg, Args&& ... args)
+        {
+            log(level::info, formatted_msg, std::forward<Args>(args)...);
+        }
+
+        template<typename... Args>
+        enable_if_ostream_insertable_t<Args...> warning(const format_string& formatted_msg, Args&& ... args)
+        {
+            log(level::warn, formatted_msg, std::forward<Args>(args)...);
+        }
+
+        template<typename... Args>
+        enable_if_ostream_insertable_t<Args...> error(const format_string& formatted_msg, Args&& ... args)
+        {
+            log(level::error, formatted_msg, std::forward<Args>(args)...);
+        }
+
+        template<typename... Args>
+        enable_if_ostream_insertable_t<Args...> critical(const format_string& formatted_msg, Args&& ... args)
+        {
+            log(level::crit, formatted_msg, std::forward<Args>(args)...);
+        }
+
         void set_filter(level lvl)
         {
             m_filter = lvl;
@@ -232,7 +385,7 @@ namespace bl {
         void set_tag(in_string tag)
         {
             m_tag = tag;
-            set_pattern(m_cached_pattern);
+            m_patterns->retag(m_tag);
 
             set_sinks_tag();
         }
@@ -254,9 +407,6 @@ namespace bl {
             if (m_sinks->empty())
                 return false;
 
-            if (m_cached_pattern.empty())
-                return false;
-
             return true;
         }
 
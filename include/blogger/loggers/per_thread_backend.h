@@ -0,0 +1,395 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <memory>
+
+#include "blogger/loggers/task.h"
+#include "blogger/loggers/ring_buffer.h"
+
+// Size of every thread's own task queue, rounded
+// up to a power of two. Once it's full the overflow
+// policy of the logger posting a message decides.
+#ifndef BLOGGER_THREAD_QUEUE_SIZE
+    #define BLOGGER_THREAD_QUEUE_SIZE 4096
+#endif
+
+namespace bl {
+
+    // Every thread that posts to this backend lazily gets its own
+    // single-producer queue, so producers never share a cache line
+    // with each other. A single worker merges all of the queues,
+    // always running the task with the earliest time point among
+    // the ones that are already queued. Producers only queue raw
+    // ticks, the worker converts every task's time point once it
+    // gets to the front of its queue. That order is best-effort:
+    // a task that's captured earlier but queued later than one on
+    // another thread can still run after it. Tasks without a time
+    // point inherit the one posted before them on the same thread.
+    // Queues share what producers touch with the backend, so either
+    // one may go away first. A thread's queue is freed once the
+    // thread has exited and the worker has drained it. Threads that
+    // post while they're exiting, or after the backend is gone, run
+    // their task on the spot.
+    class per_thread_backend : public async_backend
+    {
+    private:
+        struct thread_queue;
+
+        using queue_ptr = std::shared_ptr<thread_queue>;
+
+        // Everything producers touch besides their own queue
+        struct shared_state
+        {
+            // Queues registered since the worker last looked
+            std::vector<queue_ptr>  registered;
+            std::mutex              registry_access;
+            std::atomic_bool        registry_changed;
+
+            std::mutex              sleep_access;
+            std::condition_variable notifier;
+            std::atomic<size_t>     sleeping;
+            std::atomic_bool        running;
+
+            shared_state()
+                : registry_changed(false),
+                  sleeping(0),
+                  running(true)
+            {
+            }
+        };
+
+        using state_ptr = std::shared_ptr<shared_state>;
+
+        struct thread_queue
+        {
+            spsc_ring_buffer<task_ptr> queue;
+            state_ptr                  state;
+            std::atomic_bool           abandoned;
+
+            // Set by the producer while it's between seeing
+            // the backend running and queueing its task
+            std::atomic_bool           posting;
+
+            // Only ever touched by the worker: the time point of the
+            // task at the front, once converted, and of the one before
+            int64_t                    front_time_point;
+            bool                       front_timed;
+            int64_t                    last_time_point;
+
+            thread_queue(size_t capacity, state_ptr shared)
+                : queue(capacity),
+                  state(std::move(shared)),
+                  abandoned(false),
+                  posting(false),
+                  front_time_point(task::no_time_point),
+                  front_timed(false),
+                  last_time_point(task::no_time_point)
+            {
+            }
+        };
+
+        // Lives in thread local storage of every producer, and
+        // shares its queue with the backend
+        struct thread_handle
+        {
+            queue_ptr queue;
+
+            ~thread_handle()
+            {
+                if (queue)
+                    queue->abandoned.store(true, std::memory_order_release);
+
+                cached_queue() = nullptr;
+                thread_exited() = true;
+            }
+        };
+
+        state_ptr              m_state;
+
+        // Only ever touched by the worker
+        std::vector<queue_ptr> m_queues;
+
+        std::thread            m_worker;
+    private:
+        per_thread_backend()
+            : m_state(std::make_shared<shared_state>())
+        {
+            m_worker = std::thread([this]() { worker(); });
+        }
+
+        per_thread_backend(const per_thread_backend& other) = delete;
+        per_thread_backend(per_thread_backend&& other) = delete;
+
+        per_thread_backend& operator=(const per_thread_backend& other) = delete;
+        per_thread_backend& operator=(per_thread_backend&& other) = delete;
+
+        // Trivially destructible, so still usable
+        // while the thread's handle is being destroyed
+        static thread_queue*& cached_queue()
+        {
+            static thread_local thread_queue* s_queue = nullptr;
+            return s_queue;
+        }
+
+        static bool& thread_exited()
+        {
+            static thread_local bool s_exited = false;
+            return s_exited;
+        }
+
+        // nullptr once the thread has started exiting
+        thread_queue* local_queue()
+        {
+            auto*& cached = cached_queue();
+
+            if (cached || thread_exited())
+                return cached;
+
+            static thread_local thread_handle handle;
+
+            handle.queue = std::make_shared<thread_queue>(BLOGGER_THREAD_QUEUE_SIZE, m_state);
+            cached = handle.queue.get();
+
+            locker lock(m_state->registry_access);
+
+            // Never picked up otherwise, the queue would only keep the state alive
+            if (m_state->running.load(std::memory_order_relaxed))
+            {
+                m_state->registered.emplace_back(handle.queue);
+                m_state->registry_changed.store(true, std::memory_order_release);
+            }
+
+            return cached;
+        }
+
+        void worker()
+        {
+            auto& state = *m_state;
+
+            std::unique_lock<std::mutex> task_waiter(state.sleep_access);
+            task_waiter.unlock();
+
+            task_batch batch;
+
+            for (;;)
+            {
+                // Checked before draining, nothing can be queued anymore once it holds
+                bool stopped = !state.running && !any_posting();
+
+                if (do_work(batch))
+                    continue;
+
+                if (stopped)
+                    break;
+
+                reclaim_abandoned();
+
+                task_waiter.lock();
+                state.sleeping.fetch_add(1);
+
+                // Pairs with the fence in post_task
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                if (all_empty() && state.running)
+                    state.notifier.wait_for(
+                        task_waiter,
+                        std::chrono::milliseconds(100)
+                    );
+
+                state.sleeping.fetch_sub(1);
+                task_waiter.unlock();
+            }
+        }
+
+        // Merges up to a batch worth of tasks at once
+        bool do_work(task_batch& batch)
+        {
+            auto& state = *m_state;
+
+            if (state.registry_changed.exchange(false, std::memory_order_acquire))
+            {
+                locker lock(state.registry_access);
+
+                for (auto& queue : state.registered)
+                    m_queues.emplace_back(std::move(queue));
+
+                state.registered.clear();
+            }
+
+            while (!batch.full())
+            {
+                auto* earliest = earliest_queue();
+
+                if (!earliest)
+                    break;
+
+                batch.push(std::move(*earliest->queue.front()));
+                earliest->queue.pop();
+
+                earliest->last_time_point = earliest->front_time_point;
+                earliest->front_timed = false;
+            }
+
+            if (batch.empty())
+                return false;
+
+            batch.run();
+
+            return true;
+        }
+
+        thread_queue* earliest_queue()
+        {
+            thread_queue* earliest = nullptr;
+
+            for (auto& queue : m_queues)
+            {
+                auto* front = queue->queue.front();
+
+                if (!front)
+                    continue;
+
+                // Converted once per task, here rather than on the producer
+                if (!queue->front_timed)
+                {
+                    auto time_point = (*front)->time_point();
+
+                    queue->front_time_point = time_point == task::no_time_point ? queue->last_time_point : time_point;
+                    queue->front_timed = true;
+                }
+
+                if (!earliest || queue->front_time_point < earliest->front_time_point)
+                    earliest = queue.get();
+            }
+
+            return earliest;
+        }
+
+        bool all_empty()
+        {
+            if (m_state->registry_changed.load(std::memory_order_acquire))
+                return false;
+
+            for (auto& queue : m_queues)
+                if (!queue->queue.empty())
+                    return false;
+
+            return true;
+        }
+
+        // Queues not picked up yet count as posting
+        bool any_posting()
+        {
+            if (m_state->registry_changed.load(std::memory_order_seq_cst))
+                return true;
+
+            for (auto& queue : m_queues)
+                if (queue->posting.load(std::memory_order_seq_cst))
+                    return true;
+
+            return false;
+        }
+
+        void reclaim_abandoned()
+        {
+            for (size_t i = 0; i < m_queues.size();)
+            {
+                // The thread is gone, so once it's
+                // empty nothing will ever be pushed again
+                if (m_queues[i]->abandoned.load(std::memory_order_acquire) &&
+                    m_queues[i]->queue.empty())
+                {
+                    m_queues[i] = std::move(m_queues.back());
+                    m_queues.pop_back();
+                }
+                else
+                    ++i;
+            }
+        }
+
+        void shutdown()
+        {
+            auto& state = *m_state;
+
+            {
+                // Nothing registers from now on
+                locker lock(state.registry_access);
+                state.running.store(false, std::memory_order_seq_cst);
+            }
+
+            state.notifier.notify_all();
+
+            m_worker.join();
+
+            // The worker has picked up every registered queue
+            m_queues.clear();
+        }
+
+        static void run_on_the_spot(task_ptr& t)
+        {
+            t->complete();
+            t.reset();
+        }
+    public:
+        static per_thread_backend& get()
+        {
+            static per_thread_backend instance;
+
+            return instance;
+        }
+
+        // Never blocks and never takes a lock, except for
+        // the very first task a thread posts
+        bool try_post_task(task_ptr& t) override
+        {
+            auto* local = local_queue();
+
+            if (!local)
+            {
+                run_on_the_spot(t);
+                return true;
+            }
+
+            auto& state = *local->state;
+
+            // Either the worker sees us posting before it
+            // exits or we see that it's been stopped
+            local->posting.store(true, std::memory_order_seq_cst);
+
+            if (!state.running.load(std::memory_order_seq_cst))
+            {
+                local->posting.store(false, std::memory_order_release);
+                run_on_the_spot(t);
+
+                return true;
+            }
+
+            // Full, hand it back
+            if (!local->queue.try_push(t))
+            {
+                local->posting.store(false, std::memory_order_release);
+                return false;
+            }
+
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            if (state.sleeping.load(std::memory_order_relaxed))
+                state.notifier.notify_one();
+
+            local->posting.store(false, std::memory_order_release);
+
+            return true;
+        }
+
+        ~per_thread_backend()
+        {
+            shutdown();
+        }
+    };
+}
+
+#undef BLOGGER_THREAD_QUEUE_SIZE
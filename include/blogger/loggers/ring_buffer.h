@@ -0,0 +1,237 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+namespace bl {
+
+    // A bounded lock-free queue over a preallocated array of slots.
+    // Any number of threads may push and pop concurrently, none of
+    // them ever takes a lock. Each slot carries a sequence number
+    // that tells whether it's ready to be written or read for the
+    // current lap, so producers only contend on a single atomic
+    // increment of the enqueue position.
+    // Capacity is rounded up to the next power of two.
+    template<typename T>
+    class ring_buffer
+    {
+    private:
+        static constexpr size_t cache_line = 64;
+
+        struct slot
+        {
+            std::atomic<size_t> sequence;
+            T                   value;
+        };
+
+        std::unique_ptr<slot[]> m_slots;
+        size_t                  m_mask;
+
+        char                    m_pad0[cache_line];
+        std::atomic<size_t>     m_enqueue_pos;
+        char                    m_pad1[cache_line - sizeof(std::atomic<size_t>)];
+        std::atomic<size_t>     m_dequeue_pos;
+        char                    m_pad2[cache_line - sizeof(std::atomic<size_t>)];
+    public:
+        explicit ring_buffer(size_t capacity)
+            : m_slots(),
+              m_mask(0),
+              m_enqueue_pos(0),
+              m_dequeue_pos(0)
+        {
+            size_t rounded = 2;
+            while (rounded < capacity)
+                rounded <<= 1;
+
+            m_slots.reset(new slot[rounded]);
+            m_mask = rounded - 1;
+
+            for (size_t i = 0; i < rounded; ++i)
+                m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        ring_buffer(const ring_buffer& other) = delete;
+        ring_buffer& operator=(const ring_buffer& other) = delete;
+
+        // Moves value into the queue, fails if it's full
+        bool try_push(T& value)
+        {
+            slot* target;
+            size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+
+            for (;;)
+            {
+                target = &m_slots[pos & m_mask];
+
+                size_t sequence = target->sequence.load(std::memory_order_acquire);
+                auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+
+                if (difference == 0)
+                {
+                    if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if (difference < 0)
+                    return false;
+                else
+                    pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+
+            target->value = std::move(value);
+            target->sequence.store(pos + 1, std::memory_order_release);
+
+            return true;
+        }
+
+        // Moves the oldest value into out, fails if it's empty
+        bool try_pop(T& out)
+        {
+            slot* target;
+            size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+
+            for (;;)
+            {
+                target = &m_slots[pos & m_mask];
+
+                size_t sequence = target->sequence.load(std::memory_order_acquire);
+                auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos + 1);
+
+                if (difference == 0)
+                {
+                    if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if (difference < 0)
+                    return false;
+                else
+                    pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            }
+
+            out = std::move(target->value);
+            target->sequence.store(pos + m_mask + 1, std::memory_order_release);
+
+            return true;
+        }
+
+        size_t capacity() const
+        {
+            return m_mask + 1;
+        }
+
+        // Only a snapshot, may be stale by the time it returns
+        size_t size() const
+        {
+            size_t enqueued = m_enqueue_pos.load(std::memory_order_relaxed);
+            size_t dequeued = m_dequeue_pos.load(std::memory_order_relaxed);
+
+            return enqueued > dequeued ? enqueued - dequeued : 0;
+        }
+
+        bool empty() const
+        {
+            return size() == 0;
+        }
+    };
+
+    // A bounded lock-free queue for exactly one producer
+    // and one consumer thread. Both sides keep a cached
+    // copy of the other side's index, so they only touch
+    // the shared cache line when their copy runs out.
+    // Capacity is rounded up to the next power of two.
+    template<typename T>
+    class spsc_ring_buffer
+    {
+    private:
+        static constexpr size_t cache_line = 64;
+
+        std::unique_ptr<T[]> m_slots;
+        size_t               m_mask;
+
+        // Consumer side
+        char                 m_pad0[cache_line];
+        std::atomic<size_t>  m_head;
+        size_t               m_cached_tail;
+
+        // Producer side
+        char                 m_pad1[cache_line - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+        std::atomic<size_t>  m_tail;
+        size_t               m_cached_head;
+        char                 m_pad2[cache_line - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+    public:
+        explicit spsc_ring_buffer(size_t capacity)
+            : m_slots(),
+              m_mask(0),
+              m_head(0),
+              m_cached_tail(0),
+              m_tail(0),
+              m_cached_head(0)
+        {
+            size_t rounded = 2;
+            while (rounded < capacity)
+                rounded <<= 1;
+
+            m_slots.reset(new T[rounded]);
+            m_mask = rounded - 1;
+        }
+
+        spsc_ring_buffer(const spsc_ring_buffer& other) = delete;
+        spsc_ring_buffer& operator=(const spsc_ring_buffer& other) = delete;
+
+        // Producer only. Moves value into the queue, fails if it's full
+        bool try_push(T& value)
+        {
+            size_t tail = m_tail.load(std::memory_order_relaxed);
+
+            if (tail - m_cached_head > m_mask)
+            {
+                m_cached_head = m_head.load(std::memory_order_acquire);
+
+                if (tail - m_cached_head > m_mask)
+                    return false;
+            }
+
+            m_slots[tail & m_mask] = std::move(value);
+            m_tail.store(tail + 1, std::memory_order_release);
+
+            return true;
+        }
+
+        // Consumer only. The oldest value or nullptr if it's empty
+        T* front()
+        {
+            size_t head = m_head.load(std::memory_order_relaxed);
+
+            if (head == m_cached_tail)
+            {
+                m_cached_tail = m_tail.load(std::memory_order_acquire);
+
+                if (head == m_cached_tail)
+                    return nullptr;
+            }
+
+            return &m_slots[head & m_mask];
+        }
+
+        // Consumer only. Removes the value returned by front()
+        void pop()
+        {
+            size_t head = m_head.load(std::memory_order_relaxed);
+
+            m_slots[head & m_mask] = T();
+            m_head.store(head + 1, std::memory_order_release);
+        }
+
+        size_t capacity() const
+        {
+            return m_mask + 1;
+        }
+
+        // Only a snapshot, may be stale by the time it returns
+        bool empty() const
+        {
+            return m_head.load(std::memory_order_acquire) ==
+                   m_tail.load(std::memory_order_acquire);
+        }
+    };
+}
@@ -0,0 +1,515 @@
+#pragma once
+
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+#include "blogger/core.h"
+#include "blogger/loggers/logger.h"
+#include "blogger/loggers/ring_buffer.h"
+
+// How many tasks a worker takes off
+// its queue at most before running them
+#ifndef BLOGGER_BATCH_SIZE
+    #define BLOGGER_BATCH_SIZE 64
+#endif
+
+namespace bl {
+
+    // You can make your own tasks
+    // and feed them to the thread_pool
+    // as well.
+    class task
+    {
+    public:
+        // Tasks that weren't captured at a
+        // specific point in time return this
+        static constexpr int64_t no_time_point = INT64_MIN;
+
+        virtual void complete() = 0;
+
+        // Nanoseconds since the epoch, used by backends
+        // that order tasks from different threads
+        virtual int64_t time_point()
+        {
+            return no_time_point;
+        }
+
+        // Tasks that write one message to a set of sinks return
+        // them here, consecutive tasks going to the same sinks are
+        // then written with sink::write_batch instead of complete()
+        virtual sinks* target_sinks()
+        {
+            return nullptr;
+        }
+
+        // Gets the message ready for a batch,
+        // nullptr if there's nothing to write
+        virtual log_message* prepare()
+        {
+            return nullptr;
+        }
+
+        // Called instead of delete once the task is done with,
+        // pooled tasks go back to their pool here
+        virtual void release()
+        {
+            delete this;
+        }
+
+        virtual ~task() = default;
+    };
+
+    struct task_deleter
+    {
+        task_deleter() = default;
+
+        // So that std::unique_ptr<your_task> converts to task_ptr
+        template<typename T>
+        task_deleter(const std::default_delete<T>&)
+        {
+        }
+
+        void operator()(task* t) const
+        {
+            t->release();
+        }
+    };
+
+    // Shared by an async logger and the tasks it posted.
+    // The logger waits for queued to reach zero before
+    // it goes away, so tasks can keep a plain pointer.
+    struct queue_accounting
+    {
+        // Messages holding a slot, cancelled ones included
+        std::atomic<size_t>   queued;
+        std::atomic<size_t>   cancelled;
+        std::atomic<uint64_t> dropped;
+        std::atomic<uint64_t> unreported;
+
+        queue_accounting()
+            : queued(0),
+              cancelled(0),
+              dropped(0),
+              unreported(0)
+        {
+        }
+
+        void drop()
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            unreported.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Messages that are still going to be written
+        size_t live() const
+        {
+            size_t all = queued.load(std::memory_order_relaxed);
+            size_t gone = cancelled.load(std::memory_order_relaxed);
+
+            return all > gone ? all - gone : 0;
+        }
+    };
+
+    class message_slots;
+
+    // Refers to the logger's sinks and pattern without owning
+    // them, an async logger outlives every task it has queued.
+    // Lives in one of the logger's message_slots.
+    class log_task : public task
+    {
+        friend class message_slots;
+    private:
+        // What state holds once the task is no longer queued
+        static constexpr size_t taken     = static_cast<size_t>(-1);
+        static constexpr size_t cancelled = static_cast<size_t>(-2);
+
+        log_message           msg;
+        sinks*                log_sinks;
+        queue_accounting*     accounting;
+        message_slots*        owner;
+
+        // Of its slot, in the order the logger posted its messages
+        size_t                position;
+
+        // The position while it's queued, taken once a worker
+        // got to it, or cancelled to make room for newer ones
+        std::atomic<size_t>   state;
+        bool                  completed;
+
+        // Flushes the sinks instead of writing msg. Atomic as
+        // cancel_oldest may look at a slot that's being reused.
+        std::atomic<bool>     flush_only;
+    public:
+        log_task()
+            : msg(nullptr, 0, level::trace),
+              log_sinks(nullptr),
+              accounting(nullptr),
+              owner(nullptr),
+              position(0),
+              state(taken),
+              completed(false),
+              flush_only(false)
+        {
+        }
+
+        void reset(
+            log_message&& message,
+            sinks& message_sinks,
+            queue_accounting* message_accounting
+        )
+        {
+            msg = std::move(message);
+            log_sinks = &message_sinks;
+            accounting = message_accounting;
+            completed = false;
+            flush_only.store(false, std::memory_order_relaxed);
+
+            if (accounting)
+                accounting->queued.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Turns the slot into a flush of message_sinks, so
+        // flushing an async logger doesn't allocate either
+        void reset_flush(sinks& message_sinks, queue_accounting* message_accounting)
+        {
+            log_sinks = &message_sinks;
+            accounting = message_accounting;
+            completed = false;
+            flush_only.store(true, std::memory_order_relaxed);
+
+            if (accounting)
+                accounting->queued.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void complete() override
+        {
+            if (!prepare())
+                return;
+
+            if (flush_only.load(std::memory_order_relaxed))
+            {
+                for (auto& sink : *log_sinks)
+                {
+                    sink->flush();
+                }
+
+                return;
+            }
+
+            for (auto& sink : *log_sinks)
+            {
+                sink->write(msg);
+            }
+        }
+
+        sinks* target_sinks() override
+        {
+            return flush_only.load(std::memory_order_relaxed) ? nullptr : log_sinks;
+        }
+
+        log_message* prepare() override
+        {
+            auto queued = position;
+
+            // Unless it was cancelled in favor of a newer message
+
+            if (!state.compare_exchange_strong(queued, taken, std::memory_order_acq_rel))
+                return nullptr;
+
+            // Rendered once a sink asks for the text
+            completed = true;
+
+            return &msg;
+        }
+
+        int64_t time_point() override
+        {
+            return flush_only.load(std::memory_order_relaxed) ? no_time_point : msg.time_point();
+        }
+
+        // A task that never got to complete was dropped
+        void release() override;
+    };
+
+    // A fixed ring of log tasks an async logger queues its messages
+    // in, allocated once along with the logger. Slots are taken in the
+    // order messages are posted in and given back once the backend is
+    // done with them. Taking one fails while the message posted a
+    // full lap earlier is still in flight, so a logger never has more
+    // than capacity messages in flight and never allocates for them.
+    // Capacity is rounded up to the next power of two.
+    class message_slots
+    {
+    private:
+        static constexpr size_t cache_line = 64;
+
+        struct slot
+        {
+            // The position it's free for, that plus one once it's queued
+            std::atomic<size_t> sequence;
+            log_task            task;
+        };
+
+        std::unique_ptr<slot[]> m_slots;
+        size_t                  m_mask;
+
+        char                    m_pad0[cache_line];
+        std::atomic<size_t>     m_next;
+        char                    m_pad1[cache_line - sizeof(std::atomic<size_t>)];
+
+        // Nothing before it is queued anymore
+        std::atomic<size_t>     m_oldest;
+        char                    m_pad2[cache_line - sizeof(std::atomic<size_t>)];
+    public:
+        explicit message_slots(size_t capacity)
+            : m_slots(),
+              m_mask(0),
+              m_next(0),
+              m_oldest(0)
+        {
+            size_t rounded = 2;
+            while (rounded < capacity)
+                rounded <<= 1;
+
+            m_slots.reset(new slot[rounded]);
+            m_mask = rounded - 1;
+
+            for (size_t i = 0; i < rounded; ++i)
+            {
+                m_slots[i].sequence.store(i, std::memory_order_relaxed);
+                m_slots[i].task.owner = this;
+            }
+        }
+
+        message_slots(const message_slots& other) = delete;
+        message_slots& operator=(const message_slots& other) = delete;
+
+        // The next slot, or nullptr if it's still in flight
+        log_task* try_take()
+        {
+            size_t pos = m_next.load(std::memory_order_relaxed);
+
+            for (;;)
+            {
+                auto& target = m_slots[pos & m_mask];
+
+                size_t sequence = target.sequence.load(std::memory_order_acquire);
+                auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+
+                if (difference == 0)
+                {
+                    if (m_next.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        target.task.position = pos;
+                        return &target.task;
+                    }
+                }
+                else if (difference < 0)
+                    return nullptr;
+                else
+                    pos = m_next.load(std::memory_order_relaxed);
+            }
+        }
+
+        // Marks a taken slot as queued once its message is filled in
+        void queue(log_task& t)
+        {
+            t.state.store(t.position, std::memory_order_relaxed);
+            m_slots[t.position & m_mask].sequence.store(t.position + 1, std::memory_order_release);
+        }
+
+        void give_back(log_task& t)
+        {
+            m_slots[t.position & m_mask].sequence.store(t.position + capacity(), std::memory_order_release);
+        }
+
+        // Cancels the oldest message no worker has gotten to yet.
+        // It keeps its slot until the backend runs into it.
+        bool cancel_oldest()
+        {
+            size_t next = m_next.load(std::memory_order_acquire);
+            size_t pos = m_oldest.load(std::memory_order_relaxed);
+
+            // Anything a lap behind has been given back
+            if (next - pos > capacity())
+                pos = next - capacity();
+
+            bool done = false;
+
+            for (; pos < next; ++pos)
+            {
+                auto& target = m_slots[pos & m_mask];
+                size_t sequence = target.sequence.load(std::memory_order_acquire);
+
+                // Still being filled in, the oldest one can't be told apart yet
+                if (sequence == pos)
+                    break;
+
+                // Flushes are never dropped. If the slot is being reused
+                // already, the compare exchange below fails anyway.
+                if (sequence != pos + 1 || target.task.flush_only.load(std::memory_order_relaxed))
+                    continue;
+
+                size_t queued = pos;
+
+                if (target.task.state.compare_exchange_strong(queued, log_task::cancelled, std::memory_order_acq_rel))
+                {
+                    done = true;
+                    ++pos;
+                    break;
+                }
+            }
+
+            size_t oldest = m_oldest.load(std::memory_order_relaxed);
+
+            while (oldest < pos && !m_oldest.compare_exchange_weak(oldest, pos, std::memory_order_relaxed))
+                ;
+
+            return done;
+        }
+
+        size_t capacity() const
+        {
+            return m_mask + 1;
+        }
+    };
+
+    inline void log_task::release()
+    {
+        auto* owner_accounting = accounting;
+        bool dropped = !completed && !flush_only.load(std::memory_order_relaxed);
+
+        // Nobody can cancel it anymore after this
+        bool was_cancelled = state.exchange(taken, std::memory_order_acq_rel) == cancelled;
+
+        accounting = nullptr;
+
+        // Idle tasks mustn't keep an old pattern version alive
+        msg.release_pattern();
+
+        if (owner)
+            owner->give_back(*this);
+        else
+            delete this;
+
+        // Last, the logger may be gone right after this
+        if (owner_accounting)
+        {
+            if (dropped)
+                owner_accounting->drop();
+
+            if (was_cancelled)
+                owner_accounting->cancelled.fetch_sub(1, std::memory_order_relaxed);
+
+            owner_accounting->queued.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    // Something that runs tasks for async loggers
+    class async_backend
+    {
+    public:
+        using task_ptr = std::unique_ptr<task, task_deleter>;
+
+        // Leaves t alone and returns false if the backend is full
+        virtual bool try_post_task(task_ptr& t) = 0;
+
+        // Drops t if the backend is full
+        void post_task(task_ptr t)
+        {
+            try_post_task(t);
+        }
+
+        virtual ~async_backend() = default;
+    };
+
+    // Tasks a worker took off its queue in one go. Runs them
+    // in order, handing every run of consecutive tasks that go
+    // to the same sinks to each sink as a single batch. Given a
+    // counter, numbers every message that's actually written.
+    class task_batch
+    {
+    public:
+        using task_ptr = async_backend::task_ptr;
+
+        static constexpr size_t default_capacity = BLOGGER_BATCH_SIZE;
+    private:
+        std::unique_ptr<task_ptr[]>     m_tasks;
+        std::unique_ptr<log_message*[]> m_messages;
+        size_t                          m_capacity;
+        size_t                          m_size;
+        uint64_t*                       m_sequence;
+    public:
+        explicit task_batch(
+            size_t capacity = default_capacity,
+            uint64_t* sequence = nullptr
+        ) : m_tasks(new task_ptr[capacity]),
+            m_messages(new log_message*[capacity]),
+            m_capacity(capacity),
+            m_size(0),
+            m_sequence(sequence)
+        {
+        }
+
+        bool full() const
+        {
+            return m_size == m_capacity;
+        }
+
+        bool empty() const
+        {
+            return m_size == 0;
+        }
+
+        void push(task_ptr t)
+        {
+            m_tasks[m_size++] = std::move(t);
+        }
+
+        void run()
+        {
+            for (size_t first = 0; first < m_size;)
+            {
+                auto* target = m_tasks[first]->target_sinks();
+
+                if (!target)
+                {
+                    m_tasks[first]->complete();
+                    m_tasks[first++].reset();
+                    continue;
+                }
+
+                size_t last = first;
+                size_t count = 0;
+
+                for (; last < m_size && m_tasks[last]->target_sinks() == target; ++last)
+                {
+                    auto* msg = m_tasks[last]->prepare();
+
+                    if (!msg)
+                        continue;
+
+                    if (m_sequence)
+                        msg->set_sequence(++*m_sequence);
+
+                    m_messages[count++] = msg;
+                }
+
+                if (count)
+                {
+                    for (auto& sink : *target)
+                        sink->write_batch(m_messages.get(), count);
+                }
+
+                // Only now, the logger may go away once its tasks are released
+                for (; first < last; ++first)
+                    m_tasks[first].reset();
+            }
+
+            m_size = 0;
+        }
+    };
+}
+
+#undef BLOGGER_BATCH_SIZE
@@ -0,0 +1,300 @@
+#pragma once
+
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <cstdint>
+#include <atomic>
+
+#include "blogger/core.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    #include <intrin.h>
+    #define BLOGGER_HAS_RDTSC
+    #define BLOGGER_RDTSC() __rdtsc()
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    #include <x86intrin.h>
+    #define BLOGGER_HAS_RDTSC
+    #define BLOGGER_RDTSC() __rdtsc()
+#endif
+
+#ifdef __linux__
+    #include <time.h>
+#endif
+
+namespace bl {
+
+    // Where a logger takes the time points of its messages from.
+    // now() runs on the logging thread for every message and should
+    // be as cheap as possible, to_nanoseconds() only runs when the
+    // message is formatted, which for async loggers is off the hot path.
+    // Derive from it to supply your own clock.
+    class clock_source
+    {
+    public:
+        using ptr = std::shared_ptr<clock_source>;
+
+        static ptr make_system();
+
+        static ptr make_coarse();
+
+        static ptr make_tsc();
+
+        // Raw ticks in whatever unit the clock likes
+        virtual uint64_t now() const = 0;
+
+        // Nanoseconds since the epoch for the given ticks
+        virtual int64_t to_nanoseconds(uint64_t ticks) const = 0;
+
+        // Roughly the ticks at nanoseconds since the epoch, so that
+        // sinks can compare raw ticks against a point in time without
+        // converting every message. 0 if the clock can't tell.
+        virtual uint64_t to_ticks(int64_t nanoseconds) const
+        {
+            (void) nanoseconds;
+            return 0;
+        }
+
+        virtual ~clock_source() = default;
+    };
+
+    // std::chrono::system_clock, ticks are nanoseconds since the epoch.
+    class system_clock_source : public clock_source
+    {
+    public:
+        uint64_t now() const override
+        {
+            return static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()
+                ).count()
+            );
+        }
+
+        int64_t to_nanoseconds(uint64_t ticks) const override
+        {
+            return static_cast<int64_t>(ticks);
+        }
+
+        uint64_t to_ticks(int64_t nanoseconds) const override
+        {
+            return nanoseconds > 0 ? static_cast<uint64_t>(nanoseconds) : 0;
+        }
+    };
+
+    // CLOCK_REALTIME_COARSE on linux, which is served from the vDSO
+    // without touching the hardware, at the cost of only being as
+    // precise as the kernel tick (usually 1-4ms).
+    // Falls back to the system clock everywhere else.
+    class coarse_clock_source : public clock_source
+    {
+    public:
+        uint64_t now() const override
+        {
+          #if defined(__linux__) && defined(CLOCK_REALTIME_COARSE)
+            timespec ts;
+            clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+
+            return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull +
+                   static_cast<uint64_t>(ts.tv_nsec);
+          #else
+            return system_clock_source().now();
+          #endif
+        }
+
+        int64_t to_nanoseconds(uint64_t ticks) const override
+        {
+            return static_cast<int64_t>(ticks);
+        }
+
+        uint64_t to_ticks(int64_t nanoseconds) const override
+        {
+            return nanoseconds > 0 ? static_cast<uint64_t>(nanoseconds) : 0;
+        }
+    };
+
+    // Raw CPU timestamp counter ticks, calibrated against the
+    // steady clock on construction (which takes calibration_time).
+    // Every recalibration_interval worth of ticks the next conversion
+    // re-anchors to the system clock and refines the tick rate over
+    // everything measured so far, so it never drifts from wall time.
+    // Assumes an invariant TSC, which every x86 CPU of the last decade has.
+    // Falls back to the coarse clock on other architectures.
+    class tsc_clock_source : public clock_source
+    {
+    private:
+        struct calibration
+        {
+            uint64_t base_ticks;
+            int64_t  base_time;
+            double   ns_per_tick;
+        };
+
+        // Written under an odd m_sequence, readers retry if it changed
+        mutable std::atomic<uint64_t> m_base_ticks;
+        mutable std::atomic<int64_t>  m_base_time;
+        mutable std::atomic<double>   m_ns_per_tick;
+        mutable std::atomic<uint64_t> m_sequence;
+
+        // Where the tick rate is measured from
+        uint64_t                      m_first_ticks;
+        std::chrono::steady_clock::time_point m_first_steady;
+
+        std::chrono::nanoseconds      m_recalibration_interval;
+    public:
+        tsc_clock_source(
+            std::chrono::milliseconds calibration_time = std::chrono::milliseconds(10),
+            std::chrono::milliseconds recalibration_interval = std::chrono::milliseconds(1000)
+        ) : m_base_ticks(0),
+            m_base_time(0),
+            m_ns_per_tick(1.0),
+            m_sequence(0),
+            m_first_ticks(0),
+            m_first_steady(),
+            m_recalibration_interval(recalibration_interval)
+        {
+          #ifdef BLOGGER_HAS_RDTSC
+            m_first_steady = std::chrono::steady_clock::now();
+            m_first_ticks  = BLOGGER_RDTSC();
+
+            std::this_thread::sleep_for(calibration_time);
+
+            m_sequence.store(1, std::memory_order_relaxed);
+            anchor();
+          #else
+            (void) calibration_time;
+          #endif
+        }
+
+        uint64_t now() const override
+        {
+          #ifdef BLOGGER_HAS_RDTSC
+            return BLOGGER_RDTSC();
+          #else
+            return coarse_clock_source().now();
+          #endif
+        }
+
+        int64_t to_nanoseconds(uint64_t ticks) const override
+        {
+          #ifdef BLOGGER_HAS_RDTSC
+            auto current = load();
+
+            // Signed so that ticks captured before
+            // the last anchor don't wrap around
+            auto delta = static_cast<int64_t>(ticks - current.base_ticks);
+            auto elapsed = static_cast<double>(delta) * current.ns_per_tick;
+
+            if (elapsed > static_cast<double>(m_recalibration_interval.count()) && recalibrate())
+            {
+                current = load();
+                delta = static_cast<int64_t>(ticks - current.base_ticks);
+                elapsed = static_cast<double>(delta) * current.ns_per_tick;
+            }
+
+            return current.base_time + static_cast<int64_t>(elapsed);
+          #else
+            return static_cast<int64_t>(ticks);
+          #endif
+        }
+
+        // Against the current anchor, which moves by
+        // a hair every time it's recalibrated
+        uint64_t to_ticks(int64_t nanoseconds) const override
+        {
+          #ifdef BLOGGER_HAS_RDTSC
+            auto current = load();
+            auto ticks = static_cast<double>(nanoseconds - current.base_time) / current.ns_per_tick;
+
+            if (ticks < -static_cast<double>(current.base_ticks))
+                return 0;
+
+            return current.base_ticks + static_cast<int64_t>(ticks);
+          #else
+            return nanoseconds > 0 ? static_cast<uint64_t>(nanoseconds) : 0;
+          #endif
+        }
+
+        double ns_per_tick() const
+        {
+            return load().ns_per_tick;
+        }
+    private:
+        calibration load() const
+        {
+            calibration current;
+            uint64_t sequence;
+
+            do
+            {
+                sequence = m_sequence.load(std::memory_order_acquire);
+
+                current.base_ticks  = m_base_ticks.load(std::memory_order_relaxed);
+                current.base_time   = m_base_time.load(std::memory_order_relaxed);
+                current.ns_per_tick = m_ns_per_tick.load(std::memory_order_relaxed);
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+            } while ((sequence & 1) || sequence != m_sequence.load(std::memory_order_relaxed));
+
+            return current;
+        }
+
+        // Only one thread gets to do it, the rest keep the old anchor
+        bool recalibrate() const
+        {
+            auto sequence = m_sequence.load(std::memory_order_relaxed);
+
+            if ((sequence & 1) ||
+                !m_sequence.compare_exchange_strong(sequence, sequence + 1, std::memory_order_acquire))
+                return false;
+
+            anchor();
+
+            return true;
+        }
+
+        // With m_sequence odd, leaves it even
+        void anchor() const
+        {
+          #ifdef BLOGGER_HAS_RDTSC
+            auto steady = std::chrono::steady_clock::now();
+            uint64_t ticks = BLOGGER_RDTSC();
+            auto time = static_cast<int64_t>(system_clock_source().now());
+
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(steady - m_first_steady).count();
+
+            std::atomic_thread_fence(std::memory_order_release);
+
+            if (ticks > m_first_ticks)
+                m_ns_per_tick.store(static_cast<double>(elapsed) / static_cast<double>(ticks - m_first_ticks), std::memory_order_relaxed);
+
+            m_base_ticks.store(ticks, std::memory_order_relaxed);
+            m_base_time.store(time, std::memory_order_relaxed);
+
+            m_sequence.fetch_add(1, std::memory_order_release);
+          #endif
+        }
+    };
+
+    inline clock_source::ptr clock_source::make_system()
+    {
+        return std::make_shared<system_clock_source>();
+    }
+
+    inline clock_source::ptr clock_source::make_coarse()
+    {
+        return std::make_shared<coarse_clock_source>();
+    }
+
+    inline clock_source::ptr clock_source::make_tsc()
+    {
+        return std::make_shared<tsc_clock_source>();
+    }
+
+    // The clock loggers use unless told otherwise
+    inline const clock_source::ptr& default_clock()
+    {
+        static clock_source::ptr s_clock = clock_source::make_system();
+        return s_clock;
+    }
+}
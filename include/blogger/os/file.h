@@ -0,0 +1,744 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+#include "blogger/core.h"
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <errno.h>
+    #include <dirent.h>
+    #include <sys/stat.h>
+    #include <sys/file.h>
+    #include <sys/uio.h>
+    #include <sys/mman.h>
+#endif
+
+namespace bl {
+
+  #ifndef _WIN32
+    // A path the way the OS functions take it
+    class native_path
+    {
+    private:
+      #ifdef BLOGGER_UNICODE_MODE
+        std::vector<char> m_narrow;
+      #endif
+        const char*       m_path;
+    public:
+        explicit native_path(const string& path)
+            : m_path(nullptr)
+        {
+          #ifdef BLOGGER_UNICODE_MODE
+            m_narrow.resize(path.size() * 4 + 1);
+
+            auto size = wcstombs(m_narrow.data(), path.c_str(), m_narrow.size());
+            if (size == static_cast<size_t>(-1))
+                return;
+
+            m_narrow[size] = '\0';
+            m_path = m_narrow.data();
+          #else
+            m_path = path.c_str();
+          #endif
+        }
+
+        // Null if the path couldn't be converted
+        operator const char*() const
+        {
+            return m_path;
+        }
+    };
+  #endif
+
+    // Replaces to if it exists
+    inline bool rename_file(const string& from, const string& to)
+    {
+      #ifdef _WIN32
+        #ifdef BLOGGER_UNICODE_MODE
+          return MoveFileExW(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING);
+        #else
+          return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING);
+        #endif
+      #else
+        native_path native_from(from);
+        native_path native_to(to);
+
+        return native_from && native_to && ::rename(native_from, native_to) == 0;
+      #endif
+    }
+
+    inline bool file_exists(const string& path)
+    {
+      #ifdef _WIN32
+        #ifdef BLOGGER_UNICODE_MODE
+          return GetFileAttributesW(path.c_str()) != INVALID_FILE_ATTRIBUTES;
+        #else
+          return GetFileAttributesA(path.c_str()) != INVALID_FILE_ATTRIBUTES;
+        #endif
+      #else
+        native_path native(path);
+
+        return native && ::access(native, F_OK) == 0;
+      #endif
+    }
+
+    // For reading back finished files, mode is a plain fopen mode
+    inline FILE* open_stdio(const string& path, const char* mode)
+    {
+      #ifdef _WIN32
+        FILE* file = nullptr;
+
+        #ifdef BLOGGER_UNICODE_MODE
+          wchar_t wide_mode[8] = {};
+
+          for (size_t i = 0; mode[i] && i < 7; ++i)
+              wide_mode[i] = static_cast<wchar_t>(mode[i]);
+
+          _wfopen_s(&file, path.c_str(), wide_mode);
+        #else
+          fopen_s(&file, path.c_str(), mode);
+        #endif
+
+        return file;
+      #else
+        native_path native(path);
+
+        return native ? fopen(native, mode) : nullptr;
+      #endif
+    }
+
+    inline bool remove_file(const string& path)
+    {
+      #ifdef _WIN32
+        #ifdef BLOGGER_UNICODE_MODE
+          return DeleteFileW(path.c_str());
+        #else
+          return DeleteFileA(path.c_str());
+        #endif
+      #else
+        native_path native(path);
+
+        return native && ::unlink(native) == 0;
+      #endif
+    }
+
+    struct file_entry
+    {
+        string   name;
+        uint64_t size;
+
+        // Nanoseconds since the epoch
+        int64_t  modified;
+    };
+
+    // The regular files in directory, empty if it can't be read
+    inline std::vector<file_entry> list_files(const string& directory)
+    {
+        std::vector<file_entry> files;
+
+      #ifdef _WIN32
+        auto pattern = directory + BLOGGER_WIDEN_IF_NEEDED('*');
+
+        #ifdef BLOGGER_UNICODE_MODE
+          WIN32_FIND_DATAW found;
+          auto search = FindFirstFileW(pattern.c_str(), &found);
+          auto find_next = FindNextFileW;
+        #else
+          WIN32_FIND_DATAA found;
+          auto search = FindFirstFileA(pattern.c_str(), &found);
+          auto find_next = FindNextFileA;
+        #endif
+
+        if (search == INVALID_HANDLE_VALUE)
+            return files;
+
+        do
+        {
+            if (found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+                continue;
+
+            auto size = (static_cast<uint64_t>(found.nFileSizeHigh) << 32) | found.nFileSizeLow;
+            auto written = (static_cast<uint64_t>(found.ftLastWriteTime.dwHighDateTime) << 32) |
+                           found.ftLastWriteTime.dwLowDateTime;
+
+            // From 100ns since 1601
+            auto modified = (static_cast<int64_t>(written) - 116444736000000000) * 100;
+
+            files.push_back({ found.cFileName, size, modified });
+        } while (find_next(search, &found));
+
+        FindClose(search);
+      #else
+        native_path native(directory);
+
+        if (!native)
+            return files;
+
+        // Empty means the working directory
+        auto* dir = opendir(*native ? static_cast<const char*>(native) : ".");
+
+        if (!dir)
+            return files;
+
+        while (auto* item = readdir(dir))
+        {
+            struct stat info;
+
+            if (fstatat(dirfd(dir), item->d_name, &info, 0) != 0 || !S_ISREG(info.st_mode))
+                continue;
+
+            string name;
+
+          #ifdef BLOGGER_UNICODE_MODE
+            name.resize(strlen(item->d_name));
+
+            auto size = mbstowcs(&name[0], item->d_name, name.size());
+            if (size == static_cast<size_t>(-1))
+                continue;
+
+            name.resize(size);
+          #else
+            name = item->d_name;
+          #endif
+
+            auto modified = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+
+            files.push_back({ std::move(name), static_cast<uint64_t>(info.st_size), modified });
+        }
+
+        closedir(dir);
+      #endif
+
+        return files;
+    }
+
+    enum class file_mode
+    {
+        // Appends to an emptied file
+        truncate,
+
+        // Appends to whatever is already there
+        append,
+
+        // Read and write at any offset, starts empty
+        random_access,
+
+        // Read and write at any offset, keeps what's there
+        update
+    };
+
+    // A file without any buffering of its own, a
+    // file descriptor on linux and a HANDLE on windows.
+    class file_handle
+    {
+    public:
+      #ifdef _WIN32
+        using native = HANDLE;
+      #else
+        using native = int;
+      #endif
+    private:
+        native m_handle;
+    public:
+        file_handle()
+            : m_handle(invalid())
+        {
+        }
+
+        file_handle(const file_handle& other) = delete;
+        file_handle& operator=(const file_handle& other) = delete;
+
+        file_handle(file_handle&& other) noexcept
+            : m_handle(other.m_handle)
+        {
+            other.m_handle = invalid();
+        }
+
+        file_handle& operator=(file_handle&& other) noexcept
+        {
+            if (this != &other)
+            {
+                close();
+                m_handle = other.m_handle;
+                other.m_handle = invalid();
+            }
+
+            return *this;
+        }
+
+        bool open(const string& path, file_mode mode = file_mode::truncate)
+        {
+            close();
+
+            bool truncate = mode == file_mode::truncate || mode == file_mode::random_access;
+            bool any_offset = mode == file_mode::random_access || mode == file_mode::update;
+
+          #ifdef _WIN32
+            #ifdef BLOGGER_UNICODE_MODE
+              auto open_file = CreateFileW;
+            #else
+              auto open_file = CreateFileA;
+            #endif
+
+            m_handle = open_file(
+                path.c_str(),
+                any_offset ? GENERIC_READ | GENERIC_WRITE : FILE_APPEND_DATA,
+                FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                NULL,
+                truncate ? CREATE_ALWAYS : OPEN_ALWAYS,
+                FILE_ATTRIBUTE_NORMAL,
+                NULL
+            );
+          #else
+            int flags = O_CREAT | O_CLOEXEC;
+
+            if (any_offset)
+                flags |= O_RDWR;
+            else
+                flags |= O_WRONLY | O_APPEND;
+
+            if (truncate)
+                flags |= O_TRUNC;
+
+            native_path narrow(path);
+
+            if (!narrow)
+                return false;
+
+            m_handle = ::open(narrow, flags, 0644);
+          #endif
+
+            return is_open();
+        }
+
+        bool is_open() const
+        {
+            return m_handle != invalid();
+        }
+
+        native get() const
+        {
+            return m_handle;
+        }
+
+        // Writes all of it, retrying short writes
+        bool write(const char* data, size_t size)
+        {
+            return write(data, size, nullptr, 0);
+        }
+
+        // Writes both chunks back to back with a single call where possible
+        bool write(const char* first, size_t first_size, const char* second, size_t second_size)
+        {
+          #ifdef _WIN32
+            return write_all(first, first_size) && write_all(second, second_size);
+          #else
+            iovec chunks[2] = {
+                { const_cast<char*>(first),  first_size  },
+                { const_cast<char*>(second), second_size }
+            };
+
+            iovec* next = chunks;
+            int count = second_size ? 2 : 1;
+
+            while (count)
+            {
+                if (!next->iov_len)
+                {
+                    ++next;
+                    --count;
+                    continue;
+                }
+
+                auto written = ::writev(m_handle, next, count);
+
+                if (written < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+
+                    return false;
+                }
+
+                auto left = static_cast<size_t>(written);
+
+                while (count && left >= next->iov_len)
+                {
+                    left -= next->iov_len;
+                    ++next;
+                    --count;
+                }
+
+                if (count)
+                {
+                    next->iov_base = static_cast<char*>(next->iov_base) + left;
+                    next->iov_len -= left;
+                }
+            }
+
+            return true;
+          #endif
+        }
+
+        // Makes sure there's disk space behind the range, the file
+        // is expected to end at offset. Grows the file to fit it.
+        bool reserve(uint64_t offset, uint64_t size)
+        {
+          #ifdef __linux__
+            if (::fallocate(m_handle, 0, static_cast<off_t>(offset), static_cast<off_t>(size)) == 0)
+                return true;
+          #endif
+
+            // Not supported by the file system, the
+            // space is only claimed once it's written
+            return resize(offset + size);
+        }
+
+        // Waits until everything written so far is on stable storage
+        bool sync()
+        {
+          #ifdef _WIN32
+            return FlushFileBuffers(m_handle);
+          #elif defined(__linux__)
+            return ::fdatasync(m_handle) == 0;
+          #else
+            return ::fsync(m_handle) == 0;
+          #endif
+        }
+
+        uint64_t size() const
+        {
+          #ifdef _WIN32
+            LARGE_INTEGER size;
+
+            return GetFileSizeEx(m_handle, &size) ? static_cast<uint64_t>(size.QuadPart) : 0;
+          #else
+            struct stat info;
+
+            return ::fstat(m_handle, &info) == 0 ? static_cast<uint64_t>(info.st_size) : 0;
+          #endif
+        }
+
+        // Blocks until no other process holds the lock, threads
+        // only exclude each other with handles of their own
+        bool lock()
+        {
+          #ifdef _WIN32
+            OVERLAPPED whole = {};
+
+            return LockFileEx(m_handle, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &whole);
+          #else
+            while (::flock(m_handle, LOCK_EX) != 0)
+            {
+                if (errno != EINTR)
+                    return false;
+            }
+
+            return true;
+          #endif
+        }
+
+        void unlock()
+        {
+          #ifdef _WIN32
+            OVERLAPPED whole = {};
+
+            UnlockFileEx(m_handle, 0, MAXDWORD, MAXDWORD, &whole);
+          #else
+            ::flock(m_handle, LOCK_UN);
+          #endif
+        }
+
+        // Cuts or extends the file to exactly size bytes
+        bool resize(uint64_t size)
+        {
+          #ifdef _WIN32
+            LARGE_INTEGER end;
+            end.QuadPart = static_cast<LONGLONG>(size);
+
+            return SetFilePointerEx(m_handle, end, NULL, FILE_BEGIN) && SetEndOfFile(m_handle);
+          #else
+            return ::ftruncate(m_handle, static_cast<off_t>(size)) == 0;
+          #endif
+        }
+
+        void close()
+        {
+            if (!is_open())
+                return;
+
+          #ifdef _WIN32
+            CloseHandle(m_handle);
+          #else
+            ::close(m_handle);
+          #endif
+
+            m_handle = invalid();
+        }
+
+        // A handle of its own to the same file,
+        // invalid if handle is or it can't be duplicated
+        static file_handle duplicate(native handle)
+        {
+            file_handle copy;
+
+            if (handle == invalid())
+                return copy;
+
+          #ifdef _WIN32
+            HANDLE process = GetCurrentProcess();
+
+            if (!DuplicateHandle(process, handle, process, &copy.m_handle, 0, FALSE, DUPLICATE_SAME_ACCESS))
+                copy.m_handle = invalid();
+          #else
+            copy.m_handle = ::fcntl(handle, F_DUPFD_CLOEXEC, 0);
+          #endif
+
+            return copy;
+        }
+
+        file_handle duplicate() const
+        {
+            return duplicate(m_handle);
+        }
+
+        // Gives the handle up without closing it
+        native release()
+        {
+            auto handle = m_handle;
+            m_handle = invalid();
+
+            return handle;
+        }
+
+        ~file_handle()
+        {
+            close();
+        }
+    private:
+        static native invalid()
+        {
+          #ifdef _WIN32
+            return INVALID_HANDLE_VALUE;
+          #else
+            return -1;
+          #endif
+        }
+
+      #ifdef _WIN32
+        bool write_all(const char* data, size_t size)
+        {
+            while (size)
+            {
+                DWORD written = 0;
+                DWORD chunk = size > MAXDWORD ? MAXDWORD : static_cast<DWORD>(size);
+
+                if (!WriteFile(m_handle, data, chunk, &written, NULL))
+                    return false;
+
+                data += written;
+                size -= written;
+            }
+
+            return true;
+        }
+      #endif
+    };
+
+    // A writable shared mapping of part of
+    // a file opened with file_mode::random_access or update
+    class file_view
+    {
+    private:
+        char*  m_data;
+        size_t m_size;
+      #ifdef _WIN32
+        HANDLE m_mapping;
+      #endif
+    public:
+        file_view()
+            : m_data(nullptr),
+              m_size(0)
+          #ifdef _WIN32
+            , m_mapping(NULL)
+          #endif
+        {
+        }
+
+        file_view(const file_view& other) = delete;
+        file_view& operator=(const file_view& other) = delete;
+
+        // Offsets have to be a multiple of this
+        static size_t granularity()
+        {
+          #ifdef _WIN32
+            SYSTEM_INFO info;
+            GetSystemInfo(&info);
+
+            return info.dwAllocationGranularity;
+          #else
+            return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+          #endif
+        }
+
+        // The file has to be at least offset + size bytes long
+        bool map(file_handle& file, uint64_t offset, size_t size)
+        {
+            unmap();
+
+          #ifdef _WIN32
+            m_mapping = CreateFileMappingW(file.get(), NULL, PAGE_READWRITE, 0, 0, NULL);
+
+            if (!m_mapping)
+                return false;
+
+            auto* view = MapViewOfFile(
+                m_mapping,
+                FILE_MAP_WRITE,
+                static_cast<DWORD>(offset >> 32),
+                static_cast<DWORD>(offset & 0xFFFFFFFF),
+                size
+            );
+
+            if (!view)
+            {
+                CloseHandle(m_mapping);
+                m_mapping = NULL;
+                return false;
+            }
+          #else
+            auto* view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file.get(), static_cast<off_t>(offset));
+
+            if (view == MAP_FAILED)
+                return false;
+          #endif
+
+            m_data = static_cast<char*>(view);
+            m_size = size;
+
+            return true;
+        }
+
+        char* data()
+        {
+            return m_data;
+        }
+
+        size_t size() const
+        {
+            return m_size;
+        }
+
+        // Writes the first size bytes back to the file, the file
+        // itself still has to be synced for them to be durable
+        // Without wait the pages are only scheduled for writing,
+        // syncing the file afterwards waits for them
+        bool sync(size_t size, bool wait = true)
+        {
+            if (!m_data || !size)
+                return true;
+
+          #ifdef _WIN32
+            (void) wait;
+            return FlushViewOfFile(m_data, size);
+          #else
+            return ::msync(m_data, size, wait ? MS_SYNC : MS_ASYNC) == 0;
+          #endif
+        }
+
+        void unmap()
+        {
+            if (!m_data)
+                return;
+
+          #ifdef _WIN32
+            UnmapViewOfFile(m_data);
+            CloseHandle(m_mapping);
+            m_mapping = NULL;
+          #else
+            munmap(m_data, m_size);
+          #endif
+
+            m_data = nullptr;
+            m_size = 0;
+        }
+
+        ~file_view()
+        {
+            unmap();
+        }
+    };
+
+    // A heap buffer aligned for direct I/O
+    class aligned_buffer
+    {
+    private:
+        char*  m_data;
+        size_t m_size;
+    public:
+        static constexpr size_t alignment = 4096;
+
+        aligned_buffer()
+            : m_data(nullptr),
+              m_size(0)
+        {
+        }
+
+        aligned_buffer(const aligned_buffer& other) = delete;
+        aligned_buffer& operator=(const aligned_buffer& other) = delete;
+
+        // Rounded up to the alignment, false if out of memory
+        bool allocate(size_t size)
+        {
+            release();
+
+            size = (size + alignment - 1) / alignment * alignment;
+
+          #ifdef _WIN32
+            m_data = static_cast<char*>(_aligned_malloc(size, alignment));
+          #else
+            void* data = nullptr;
+
+            if (posix_memalign(&data, alignment, size) == 0)
+                m_data = static_cast<char*>(data);
+          #endif
+
+            m_size = m_data ? size : 0;
+
+            return m_data;
+        }
+
+        char* data()
+        {
+            return m_data;
+        }
+
+        size_t size() const
+        {
+            return m_size;
+        }
+
+        void release()
+        {
+          #ifdef _WIN32
+            _aligned_free(m_data);
+          #else
+            free(m_data);
+          #endif
+
+            m_data = nullptr;
+            m_size = 0;
+        }
+
+        ~aligned_buffer()
+        {
+            release();
+        }
+    };
+}
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__linux__) && !defined(BLOGGER_NO_IO_URING) && defined(__has_include)
+    #if __has_include(<linux/io_uring.h>)
+        #define BLOGGER_HAS_IO_URING
+    #endif
+#endif
+
+#ifdef BLOGGER_HAS_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+
+namespace bl {
+
+    // A minimal io_uring over the raw syscalls, so that there's no
+    // dependency on liburing. Only ever used by one thread at a time.
+    class io_ring
+    {
+    public:
+        struct completion
+        {
+            uint64_t user_data;
+            int32_t  result;
+        };
+    private:
+        int            m_fd;
+
+        void*          m_sq_ring;
+        size_t         m_sq_ring_size;
+        void*          m_cq_ring;
+        size_t         m_cq_ring_size;
+        io_uring_sqe*  m_sqes;
+        size_t         m_sqes_size;
+
+        unsigned*      m_sq_tail;
+        unsigned*      m_sq_mask;
+        unsigned*      m_sq_array;
+        unsigned*      m_cq_head;
+        unsigned*      m_cq_tail;
+        unsigned*      m_cq_mask;
+        io_uring_cqe*  m_cqes;
+
+        unsigned       m_pending;
+    public:
+        io_ring()
+            : m_fd(-1),
+              m_sq_ring(MAP_FAILED),
+              m_sq_ring_size(0),
+              m_cq_ring(MAP_FAILED),
+              m_cq_ring_size(0),
+              m_sqes(static_cast<io_uring_sqe*>(MAP_FAILED)),
+              m_sqes_size(0),
+              m_pending(0)
+        {
+        }
+
+        io_ring(const io_ring& other) = delete;
+        io_ring& operator=(const io_ring& other) = delete;
+
+        // False if the kernel doesn't support it or doesn't let us use it
+        bool setup(unsigned entries)
+        {
+            io_uring_params params;
+            std::memset(&params, 0, sizeof(params));
+
+            m_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+
+            if (m_fd < 0)
+                return false;
+
+            // Came along with IORING_OP_WRITE in 5.6
+            if (!(params.features & IORING_FEAT_RW_CUR_POS))
+                return false;
+
+            m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+            bool single_map = params.features & IORING_FEAT_SINGLE_MMAP;
+
+            if (single_map)
+            {
+                if (m_cq_ring_size > m_sq_ring_size)
+                    m_sq_ring_size = m_cq_ring_size;
+
+                m_cq_ring_size = 0;
+            }
+
+            m_sq_ring = mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+
+            if (m_sq_ring == MAP_FAILED)
+                return false;
+
+            if (single_map)
+                m_cq_ring = m_sq_ring;
+            else
+            {
+                m_cq_ring = mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+
+                if (m_cq_ring == MAP_FAILED)
+                    return false;
+            }
+
+            m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+            m_sqes = static_cast<io_uring_sqe*>(
+                mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES)
+            );
+
+            if (m_sqes == MAP_FAILED)
+                return false;
+
+            auto* sq = static_cast<char*>(m_sq_ring);
+            auto* cq = static_cast<char*>(m_cq_ring);
+
+            m_sq_tail  = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+            m_sq_mask  = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+            m_sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+            m_cq_head  = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+            m_cq_tail  = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+            m_cq_mask  = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+            m_cqes     = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+            return true;
+        }
+
+        // Queues a write of data at offset, submitted with the next enter()
+        void prepare_write(int fd, const char* data, size_t size, uint64_t offset, uint64_t user_data)
+        {
+            unsigned tail = *m_sq_tail;
+            unsigned index = tail & *m_sq_mask;
+
+            auto& sqe = m_sqes[index];
+            std::memset(&sqe, 0, sizeof(sqe));
+
+            sqe.opcode    = IORING_OP_WRITE;
+            sqe.fd        = fd;
+            sqe.addr      = reinterpret_cast<uint64_t>(data);
+            sqe.len       = static_cast<uint32_t>(size);
+            sqe.off       = offset;
+            sqe.user_data = user_data;
+
+            m_sq_array[index] = index;
+
+            // The kernel may read the entry as soon as it sees the tail
+            __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+            ++m_pending;
+        }
+
+        // Submits everything prepared, waiting for at least wait_for completions
+        bool enter(unsigned wait_for = 0)
+        {
+            unsigned flags = wait_for ? IORING_ENTER_GETEVENTS : 0;
+
+            for (;;)
+            {
+                auto submitted = syscall(__NR_io_uring_enter, m_fd, m_pending, wait_for, flags, nullptr, 0);
+
+                if (submitted >= 0)
+                {
+                    m_pending -= static_cast<unsigned>(submitted);
+                    return true;
+                }
+
+                if (errno != EINTR)
+                    return false;
+            }
+        }
+
+        // Takes one finished request, if there is one
+        bool pop(completion& out)
+        {
+            unsigned head = *m_cq_head;
+
+            if (head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE))
+                return false;
+
+            auto& cqe = m_cqes[head & *m_cq_mask];
+
+            out.user_data = cqe.user_data;
+            out.result = cqe.res;
+
+            __atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+
+            return true;
+        }
+
+        ~io_ring()
+        {
+            if (m_sqes != MAP_FAILED)
+                munmap(m_sqes, m_sqes_size);
+
+            if (m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring)
+                munmap(m_cq_ring, m_cq_ring_size);
+
+            if (m_sq_ring != MAP_FAILED)
+                munmap(m_sq_ring, m_sq_ring_size);
+
+            if (m_fd >= 0)
+                ::close(m_fd);
+        }
+    };
+}
+
+#endif
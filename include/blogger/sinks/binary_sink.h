@@ -0,0 +1,293 @@
+#pragma once
+
+#include <stdio.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+
+#include "blogger/sinks/sink.h"
+#include "blogger/deferred.h"
+#include "blogger/os/functions.h"
+
+namespace bl {
+
+    // Writes log messages as compact binary records instead of text.
+    // Format strings and patterns (along with their tags) are interned,
+    // each is written once as a dictionary record and referred to by id.
+    // Turn the file back into text with the blogger-decode tool.
+    //
+    // Layout, all integers in native byte order:
+    //     "BLOGBIN" '\0', u8 version, u8 sizeof(char_t)
+    //     records, each starting with a u8 record_kind:
+    //         format:    u32 id, u32 size, characters
+    //         pattern:   u32 id, u32 tag size, tag, u32 size, pattern,
+    //                    u32 size, ending, u64 max length (0 for none),
+    //                    u32 size, overflow postfix
+    //         timestamp: u32 size, strftime format characters, applies
+    //                    to the messages after it
+    //         message:   u32 format id, u32 pattern id, i64 nanoseconds
+    //                    since the epoch, u64 sequence, u8 level,
+    //                    u32 size, deferred payload with an empty format
+    //                    (see deferred_reader), all sizes in characters
+    //
+    // Messages formatted on the logging thread are
+    // stored with the format "{}" and their text.
+    // Ending and cut settings are taken when a pattern is first seen.
+    class binary_sink : public sink
+    {
+    public:
+        constexpr static uint8_t version = 2;
+
+        // 8 bytes including the null terminator
+        static const char* magic()
+        {
+            return "BLOGBIN";
+        }
+
+        enum class record_kind : uint8_t
+        {
+            format = 1,
+            pattern,
+            timestamp,
+            message
+        };
+    private:
+        FILE*                                     m_file;
+        std::vector<string>                       m_formats;
+        std::unordered_multimap<uint64_t, size_t> m_format_ids;
+
+        // Pattern versions are immutable and unique across loggers
+        std::unordered_map<uint64_t, uint32_t>    m_pattern_ids;
+        uint64_t                                  m_timestamp_generation;
+        message_buffer                            m_payload;
+        std::vector<char>                         m_record;
+        std::mutex                                m_file_access;
+    public:
+        binary_sink(in_string path)
+            : m_file(nullptr),
+              m_timestamp_generation(0)
+        {
+            open(string(path.data(), path.size()));
+
+            if (!m_file)
+                return;
+
+            m_record.insert(m_record.end(), magic(), magic() + 8);
+            put(static_cast<uint8_t>(version));
+            put(static_cast<uint8_t>(sizeof(char_t)));
+            put_timestamp();
+
+            commit();
+        }
+
+        bool ok()
+        {
+            return static_cast<bool>(m_file);
+        }
+
+        void write(log_message& msg) override
+        {
+            locker lock(m_file_access);
+
+            if (!ok())
+                return;
+
+            put_message(msg);
+            commit();
+        }
+
+        void write_batch(log_message* const* messages, size_t count) override
+        {
+            locker lock(m_file_access);
+
+            if (!ok())
+                return;
+
+            for (size_t i = 0; i < count; ++i)
+                put_message(*messages[i]);
+
+            commit();
+        }
+
+        void flush() override
+        {
+            locker lock(m_file_access);
+
+            if (m_file)
+                fflush(m_file);
+        }
+
+        ~binary_sink()
+        {
+            if (m_file)
+                fclose(m_file);
+        }
+    private:
+        void put_message(log_message& msg)
+        {
+            const char_t* format = BLOGGER_WIDEN_IF_NEEDED("{}");
+            size_t format_size = 2;
+
+            m_payload.clear();
+
+            if (!msg.is_deferred() ||
+                !deferred::encode_portable(m_payload, msg.payload().data(), msg.payload().size(), format, format_size))
+            {
+                format = BLOGGER_WIDEN_IF_NEEDED("{}");
+                format_size = 2;
+
+                m_payload.clear();
+                deferred::encode_text(m_payload, msg.payload().data(), msg.payload().size());
+            }
+
+            if (m_timestamp_generation != formatter::timestamp_generation().load(std::memory_order_acquire))
+                put_timestamp();
+
+            auto format_id = intern_format(format, format_size);
+            auto pattern_id = intern_pattern(msg.pattern());
+
+            put(record_kind::message);
+            put(format_id);
+            put(pattern_id);
+            put(msg.time_point());
+            put(msg.sequence());
+            put(static_cast<uint8_t>(level_index(msg.log_level())));
+            put_chars(m_payload.data(), m_payload.size());
+        }
+
+        void open(const string& path)
+        {
+          #ifdef _WIN32
+            #ifdef BLOGGER_UNICODE_MODE
+              _wfopen_s(&m_file, path.c_str(), L"wb");
+            #else
+              fopen_s(&m_file, path.c_str(), "wb");
+            #endif
+          #elif defined(BLOGGER_UNICODE_MODE)
+            std::vector<char> narrow(path.size() * 4 + 1);
+
+            auto size = wcstombs(narrow.data(), path.c_str(), narrow.size());
+            if (size == static_cast<size_t>(-1))
+                return;
+
+            narrow[size] = '\0';
+            m_file = fopen(narrow.data(), "wb");
+          #else
+            m_file = fopen(path.c_str(), "wb");
+          #endif
+        }
+
+        static int level_index(level lvl)
+        {
+            const level::type levels[] = {
+                level::trace,
+                level::debug,
+                level::info,
+                level::warn,
+                level::error,
+                level::crit
+            };
+
+            for (int i = 0; i < 6; ++i)
+            {
+                if (lvl == levels[i])
+                    return i;
+            }
+
+            return 0;
+        }
+
+        static uint64_t hash(const char_t* chars, size_t size)
+        {
+            // FNV-1a
+            uint64_t result = 14695981039346656037ull;
+
+            for (size_t i = 0; i < size; ++i)
+            {
+                result ^= static_cast<uint64_t>(chars[i]);
+                result *= 1099511628211ull;
+            }
+
+            return result;
+        }
+
+        uint32_t intern_format(const char_t* format, size_t size)
+        {
+            auto key = hash(format, size);
+            auto range = m_format_ids.equal_range(key);
+
+            for (auto it = range.first; it != range.second; ++it)
+            {
+                auto& known = m_formats[it->second];
+
+                if (known.size() == size && std::equal(format, format + size, known.data()))
+                    return static_cast<uint32_t>(it->second);
+            }
+
+            auto id = m_formats.size();
+            m_formats.emplace_back(format, size);
+            m_format_ids.emplace(key, id);
+
+            put(record_kind::format);
+            put(static_cast<uint32_t>(id));
+            put_chars(format, size);
+
+            return static_cast<uint32_t>(id);
+        }
+
+        uint32_t intern_pattern(const log_pattern& pattern)
+        {
+            auto found = m_pattern_ids.find(pattern.version());
+
+            if (found != m_pattern_ids.end())
+                return found->second;
+
+            auto id = static_cast<uint32_t>(m_pattern_ids.size());
+            m_pattern_ids.emplace(pattern.version(), id);
+
+            put(record_kind::pattern);
+            put(id);
+            put_chars(pattern.tag().data(), pattern.tag().size());
+            put_chars(pattern.source().data(), pattern.source().size());
+            put_chars(formatter::ending().data(), formatter::ending().size());
+            put(static_cast<uint64_t>(formatter::max_length()));
+            put_chars(formatter::overflow_postfix().data(), formatter::overflow_postfix().size());
+
+            return id;
+        }
+
+        void put_timestamp()
+        {
+            m_timestamp_generation = formatter::timestamp_generation().load(std::memory_order_acquire);
+
+            auto& timestamp_format = formatter::timestamp_format();
+
+            put(record_kind::timestamp);
+            put_chars(timestamp_format.data(), timestamp_format.size());
+        }
+
+        template<typename T>
+        void put(const T& value)
+        {
+            auto* bytes = reinterpret_cast<const char*>(&value);
+            m_record.insert(m_record.end(), bytes, bytes + sizeof(T));
+        }
+
+        void put_chars(const char_t* chars, size_t size)
+        {
+            put(static_cast<uint32_t>(size));
+
+            auto* bytes = reinterpret_cast<const char*>(chars);
+            m_record.insert(m_record.end(), bytes, bytes + size * sizeof(char_t));
+        }
+
+        // Writes everything put since the last commit
+        void commit()
+        {
+            fwrite(m_record.data(), 1, m_record.size(), m_file);
+            m_record.clear();
+        }
+    };
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdio.h>
+#include <memory>
+
+#include "blogger/core.h"
+#include "blogger/os/file.h"
+
+// Define BLOGGER_ZLIB and link against zlib for gzip_codec
+#ifdef BLOGGER_ZLIB
+    #include <zlib.h>
+#endif
+
+namespace bl {
+
+    // Compresses finished log files, derive from it to plug in your own.
+    // Called from the compressor threads, several files may be
+    // compressed at once.
+    class codec
+    {
+    public:
+        using ptr = std::shared_ptr<codec>;
+
+        // Added to the name of compressed files, e.g. ".gz"
+        virtual const char_t* extension() const = 0;
+
+        // Writes a compressed copy of from to to, level is -1 for
+        // the codec's default. False if it didn't work out.
+        virtual bool compress(const string& from, const string& to, int level) = 0;
+
+        virtual ~codec() = default;
+
+    #ifdef BLOGGER_ZLIB
+        static ptr make_gzip();
+    #endif
+    };
+
+#ifdef BLOGGER_ZLIB
+    class gzip_codec : public codec
+    {
+    public:
+        const char_t* extension() const override
+        {
+            return BLOGGER_WIDEN_IF_NEEDED(".gz");
+        }
+
+        bool compress(const string& from, const string& to, int level) override
+        {
+            auto* in = open_stdio(from, "rb");
+
+            if (!in)
+                return false;
+
+            char mode[4] = { 'w', 'b', '\0', '\0' };
+
+            if (level >= 0 && level <= 9)
+                mode[2] = static_cast<char>('0' + level);
+
+          #if defined(_WIN32) && defined(BLOGGER_UNICODE_MODE)
+            auto out = gzopen_w(to.c_str(), mode);
+          #elif defined(_WIN32)
+            auto out = gzopen(to.c_str(), mode);
+          #else
+            native_path native(to);
+            auto out = native ? gzopen(native, mode) : nullptr;
+          #endif
+
+            if (!out)
+            {
+                fclose(in);
+                return false;
+            }
+
+            char chunk[1 << 16];
+            size_t read;
+            bool ok = true;
+
+            while (ok && (read = fread(chunk, 1, sizeof(chunk), in)) > 0)
+                ok = gzwrite(out, chunk, static_cast<unsigned>(read)) == static_cast<int>(read);
+
+            ok = !ferror(in) && ok;
+
+            fclose(in);
+
+            return gzclose(out) == Z_OK && ok;
+        }
+    };
+
+    inline codec::ptr codec::make_gzip()
+    {
+        return std::make_shared<gzip_codec>();
+    }
+#endif
+}
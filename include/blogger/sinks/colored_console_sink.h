@@ -1,7 +1,5 @@
 #pragma once
 
-#pragma once
-
 #include <iostream>
 
 #include "blogger/loggers/logger.h"
@@ -30,6 +28,38 @@ namespace bl {
             );
         }
 
+        // Messages of the same level in a row
+        // are written with a single call
+        void write_batch(log_message* const* messages, size_t count) override
+        {
+            auto& wl = global_console_write_lock();
+            locker lock(wl);
+
+            for (size_t first = 0; first < count;)
+            {
+                auto lvl = messages[first]->log_level();
+                auto& batch = this->m_batch;
+
+                batch.clear();
+
+                size_t last = first;
+
+                for (; last < count && messages[last]->log_level() == lvl; ++last)
+                    batch.append(messages[last]->data(), messages[last]->size());
+
+                scoped_console_color<stream> message_color(
+                    lvl.to_color()
+                );
+
+                this->underlying_stream().write(
+                    batch.data(),
+                    batch.size()
+                );
+
+                first = last;
+            }
+        }
+
         void flush() override
         {
             auto& wl = global_console_write_lock();
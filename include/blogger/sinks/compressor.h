@@ -0,0 +1,211 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <map>
+#include <cstdint>
+
+#include "blogger/core.h"
+#include "blogger/os/file.h"
+#include "blogger/sinks/codec.h"
+
+#ifdef __linux__
+    #include <sys/resource.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+namespace bl {
+
+    // Compresses rotated log files on low priority background
+    // threads, no more than concurrency() of them at once.
+    // Pending files are still compressed on exit.
+    class compressor
+    {
+    private:
+        using job = std::function<void()>;
+
+        std::deque<job>            m_jobs;
+        std::map<string, uint64_t> m_latest;
+        std::vector<std::thread>   m_threads;
+        std::mutex                 m_access;
+        std::condition_variable    m_notifier;
+        size_t                     m_concurrency;
+        size_t                     m_idle;
+        uint64_t                   m_generation;
+        bool                       m_running;
+    private:
+        compressor()
+            : m_concurrency(1),
+              m_idle(0),
+              m_generation(0),
+              m_running(true)
+        {
+        }
+
+        compressor(const compressor& other) = delete;
+        compressor& operator=(const compressor& other) = delete;
+
+        static void lower_priority()
+        {
+          #ifdef _WIN32
+            // Lowers I/O priority as well
+            SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+          #elif defined(__linux__)
+            auto tid = static_cast<id_t>(syscall(SYS_gettid));
+            setpriority(PRIO_PROCESS, tid, 19);
+
+            // IOPRIO_CLASS_IDLE for this thread
+            syscall(SYS_ioprio_set, 1, 0, 3 << 13);
+          #endif
+        }
+
+        // Whether this is the last file from path handed to us
+        bool is_latest(const string& path, uint64_t generation)
+        {
+            auto it = m_latest.find(path);
+
+            return it != m_latest.end() && it->second == generation;
+        }
+
+        void worker()
+        {
+            lower_priority();
+
+            std::unique_lock<std::mutex> lock(m_access);
+
+            for (;;)
+            {
+                if (m_jobs.empty())
+                {
+                    if (!m_running)
+                        return;
+
+                    ++m_idle;
+                    m_notifier.wait(lock);
+                    --m_idle;
+                    continue;
+                }
+
+                auto work = std::move(m_jobs.front());
+                m_jobs.pop_front();
+
+                lock.unlock();
+                work();
+                lock.lock();
+            }
+        }
+    public:
+        static compressor& get()
+        {
+            static compressor instance;
+
+            return instance;
+        }
+
+        // How many files may be compressed at once, 1 by default
+        void set_concurrency(size_t threads)
+        {
+            locker lock(m_access);
+
+            m_concurrency = threads ? threads : 1;
+        }
+
+        size_t concurrency()
+        {
+            locker lock(m_access);
+
+            return m_concurrency;
+        }
+
+        // Moves path out of the way right away and replaces it with a
+        // compressed path + extension later, unless a new file has
+        // been created at path by then. The uncompressed file comes
+        // back under its old name if compression fails.
+        void compress(codec::ptr with, int level, const string& path)
+        {
+            locker lock(m_access);
+
+            auto generation = ++m_generation;
+
+            string working = path;
+            working += BLOGGER_WIDEN_IF_NEEDED('.');
+            working += BLOGGER_TO_STRING(generation);
+            working += BLOGGER_WIDEN_IF_NEEDED(".compressing");
+
+            if (!rename_file(path, working))
+                return;
+
+            m_latest[path] = generation;
+
+            m_jobs.emplace_back([this, with, level, path, working, generation]() {
+                string target = path + with->extension();
+                string partial = working + with->extension();
+
+                {
+                    locker lock(m_access);
+
+                    // An older file with the same name, there's a newer one to compress
+                    if (!is_latest(path, generation))
+                    {
+                        remove_file(working);
+                        return;
+                    }
+                }
+
+                bool ok = with->compress(working, partial, level);
+
+                locker lock(m_access);
+
+                if (!is_latest(path, generation))
+                {
+                    remove_file(partial);
+                    remove_file(working);
+                    return;
+                }
+
+                m_latest.erase(path);
+
+                if (ok && rename_file(partial, target))
+                {
+                    remove_file(working);
+
+                    // A newer file has taken the name meanwhile, this one is out of date
+                    if (file_exists(path))
+                        remove_file(target);
+
+                    return;
+                }
+
+                remove_file(partial);
+
+                if (!file_exists(path))
+                    rename_file(working, path);
+                else
+                    remove_file(working);
+            });
+
+            if (!m_idle && m_threads.size() < m_concurrency)
+                m_threads.emplace_back([this]() { worker(); });
+            else
+                m_notifier.notify_one();
+        }
+
+        ~compressor()
+        {
+            {
+                locker lock(m_access);
+                m_running = false;
+            }
+
+            m_notifier.notify_all();
+
+            for (auto& t : m_threads)
+                t.join();
+        }
+    };
+}
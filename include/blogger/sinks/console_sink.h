@@ -11,6 +11,9 @@ namespace bl {
     {
     private:
         ostream& m_Stream = stream;
+    protected:
+        // Only touched under the global console lock
+        message_buffer m_batch;
     public:
         console_sink()
         {
@@ -27,6 +30,22 @@ namespace bl {
             );
         }
 
+        void write_batch(log_message* const* messages, size_t count) override
+        {
+            auto& wl = global_console_write_lock();
+            locker lock(wl);
+
+            m_batch.clear();
+
+            for (size_t i = 0; i < count; ++i)
+                m_batch.append(messages[i]->data(), messages[i]->size());
+
+            underlying_stream().write(
+                m_batch.data(),
+                m_batch.size()
+            );
+        }
+
         void flush() override
         {
             auto& wl = global_console_write_lock();
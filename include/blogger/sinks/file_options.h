@@ -0,0 +1,131 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "blogger/sinks/codec.h"
+
+#ifdef _WIN32
+    #define BLOGGER_PIPE_BUF 4096
+#else
+    #include <limits.h>
+    #define BLOGGER_PIPE_BUF PIPE_BUF
+#endif
+
+namespace bl {
+
+    // When a file sink makes sure its files are on stable storage
+    enum class durability
+    {
+        // Whenever the OS gets around to it
+        none,
+
+        // Every sync_interval
+        periodic,
+
+        // Before a message of level error or above is done being written
+        on_error,
+
+        // Within sync_interval of a message being written, all
+        // messages written in that window share a single sync
+        group_commit
+    };
+
+    // How a file sink gets its bytes to disk
+    struct file_options
+    {
+        // Size of the sink's own write buffer, 1-16 MiB is
+        // a good range. With 0 the sink uses stdio buffering.
+        size_t buffer_size = 0;
+
+        // With buffer_size set, keeps up to this many buffers being
+        // written by the kernel through io_uring while the sink fills
+        // the next one. Only waits for the disk once all of them are
+        // in flight. Falls back to a single buffer without io_uring.
+        size_t in_flight_buffers = 0;
+
+        // Maps the file into memory a window of this many bytes
+        // at a time and copies messages straight into it instead
+        // of writing them, takes precedence over buffer_size and
+        // in_flight_buffers.
+        // Rounded up to the page size (allocation granularity
+        // on windows), a few MiB is a good size.
+        size_t map_size = 0;
+
+        // Buffered bytes that trigger a write, 0 means once the buffer is full
+        size_t flush_bytes = 0;
+
+        // Buffered bytes are written out at least this often, 0 disables it
+        std::chrono::milliseconds flush_interval = std::chrono::milliseconds(1000);
+
+        durability sync_mode = durability::none;
+
+        // See durability
+        std::chrono::milliseconds sync_interval = std::chrono::milliseconds(1000);
+
+        // Several processes log to the same files. Records are appended
+        // with single writes, and the processes take turns starting new
+        // files through a lock file (.tag.lock). Size limits count
+        // every process' writes. Files aren't compressed in this mode.
+        bool shared = false;
+
+        // Largest write in shared mode, whole records are packed into
+        // writes of up to this size. Defaults to PIPE_BUF.
+        size_t atomic_write_size = BLOGGER_PIPE_BUF;
+
+        // Rotated files are compressed with this in the background,
+        // e.g. codec::make_gzip(). See compressor for how many at once.
+        codec::ptr compression;
+
+        // Passed on to the codec, -1 for its default
+        int compression_level = -1;
+
+        // Starts a new file every interval, e.g. std::chrono::hours(1).
+        // Periods are aligned to local midnight and files are named
+        // after the start of theirs: tag-2024-01-31_14-00.log.
+        // Longer than a day has to be whole days, counted from
+        // 1970-01-01, or the sink doesn't open any file.
+        // 0 only rotates by size.
+        std::chrono::seconds rotation_interval = std::chrono::seconds(0);
+
+        // Once all of the sink's files take up more than this many
+        // bytes, the oldest ones are deleted in the background.
+        // 0 for no limit.
+        uint64_t disk_budget = 0;
+
+        // Files last written to longer ago than this are deleted
+        // in the background as well, 0 keeps them
+        std::chrono::seconds max_age = std::chrono::seconds(0);
+
+        static file_options buffered(
+            size_t buffer_size,
+            std::chrono::milliseconds flush_interval = std::chrono::milliseconds(1000))
+        {
+            file_options options;
+            options.buffer_size = buffer_size;
+            options.flush_interval = flush_interval;
+
+            return options;
+        }
+
+        static file_options async_io(
+            size_t buffer_size = 1024 * 1024,
+            size_t in_flight_buffers = 4)
+        {
+            file_options options;
+            options.buffer_size = buffer_size;
+            options.in_flight_buffers = in_flight_buffers;
+
+            return options;
+        }
+
+        static file_options mapped(size_t map_size = 4 * 1024 * 1024)
+        {
+            file_options options;
+            options.map_size = map_size;
+
+            return options;
+        }
+    };
+}
@@ -1,33 +1,90 @@
 #pragma once
 
 #include <stdio.h>
+#include <time.h>
 #include <string>
+#include <vector>
 #include <mutex>
+#include <memory>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
 
 #include "blogger/sinks/sink.h"
+#include "blogger/sinks/file_writer.h"
+#include "blogger/sinks/housekeeper.h"
+#include "blogger/sinks/compressor.h"
+#include "blogger/sinks/rotation_lock.h"
 #include "blogger/os/functions.h"
 
 namespace bl {
 
+    // Rotation never opens or closes a file on the logging path.
+    // The next file is opened ahead of time on the housekeeper
+    // thread under a temporary name and swapped in once the byte
+    // limit is hit. The old file is closed and the new one gets
+    // its real name in the background.
+    // With a rotation interval every message's raw ticks are checked
+    // against the start of the next period in its clock's ticks, only
+    // messages close to it are converted to a time point. The calendar
+    // math only runs once per period.
+    // Retention runs on the housekeeper as well, after every new file
+    // and every 10 seconds.
     class file_sink : public sink
     {
     private:
-        FILE*      m_file;
-        string     m_directory_path;
-        string     m_cached_tag;
-        size_t     m_bytes_per_file;
-        size_t     m_current_bytes;
-        size_t     m_max_log_files;
-        size_t     m_current_log_files;
-        bool       m_rotate_logs;
-        std::mutex m_file_access;
+        static constexpr int64_t no_rotation = INT64_MAX;
+
+        // Messages this close to the next period, or this long after
+        // the ticks were last worked out, are converted to be sure
+        static constexpr int64_t rotation_slack   = 1000000;
+        static constexpr int64_t rotation_recheck = 1000000000;
+
+        file_options      m_options;
+        file_writer::ptr  m_writer;
+        string            m_current_path;
+        string            m_directory_path;
+        string            m_cached_tag;
+        size_t            m_bytes_per_file;
+        size_t            m_current_bytes;
+        size_t            m_max_log_files;
+        size_t            m_current_log_files;
+        bool              m_rotate_logs;
+        int64_t           m_next_rotation;
+        string            m_period;
+
+        // Messages of m_rotation_clock before m_rotation_ticks
+        // are still in the current period
+        clock_source::ptr m_rotation_clock;
+        uint64_t          m_rotation_ticks;
+        std::vector<char> m_batch;
+        std::mutex        m_file_access;
+
+        // Opened ahead of time as m_next_path for the file number m_next_index
+        file_writer::ptr  m_next;
+        string            m_next_path;
+        size_t            m_next_index;
+        bool              m_preparing;
+        bool              m_closing;
+
+        // Durability bookkeeping, see file_options::sync_mode
+        bool              m_sync_pending;
+        bool              m_unsynced_error;
+
+        // Files shared with other processes, see file_options::shared
+        rotation_lock     m_shared;
+        uint64_t          m_generation;
+        size_t            m_unchecked_bytes;
     public:
         file_sink(
             in_string directory_path,
             size_t bytes_per_file,
             size_t max_log_files,
-            bool rotate_logs = true
-        ) : m_file(nullptr),
+            bool rotate_logs = true,
+            const file_options& options = file_options()
+        ) : m_options(options),
+            m_writer(file_writer::make(options)),
+            m_current_path(),
             m_directory_path(directory_path),
             m_cached_tag(BLOGGER_WIDEN_IF_NEEDED("logfile")),
             m_bytes_per_file(bytes_per_file),
@@ -35,99 +92,297 @@ namespace bl {
             m_max_log_files(max_log_files),
             m_current_log_files(0),
             m_rotate_logs(rotate_logs),
-            m_file_access()
+            m_next_rotation(no_rotation),
+            m_period(),
+            m_rotation_clock(),
+            m_rotation_ticks(0),
+            m_batch(),
+            m_file_access(),
+            m_next(),
+            m_next_path(),
+            m_next_index(0),
+            m_preparing(false),
+            m_closing(false),
+            m_sync_pending(false),
+            m_unsynced_error(false),
+            m_shared(),
+            m_generation(0),
+            m_unchecked_bytes(0)
         {
-            if (m_directory_path.back() != BLOGGER_WIDEN_IF_NEEDED('/'))
+            // Empty means the working directory
+            if (!m_directory_path.empty() && m_directory_path.back() != BLOGGER_WIDEN_IF_NEEDED('/'))
                 m_directory_path += '/';
+
+            // Has to outlive us
+            housekeeper::get();
+
+            // The others may still be writing to a finished file
+            if (options.shared)
+                m_options.compression.reset();
+
+            if (options.buffer_size && options.flush_interval.count())
+            {
+                housekeeper::get().every(
+                    this,
+                    options.flush_interval,
+                    [this]() { flush(); }
+                );
+            }
+
+            if (retains())
+                housekeeper::get().every(this, std::chrono::seconds(10), [this]() { retain(); });
+
+            if (options.sync_mode == durability::periodic)
+                housekeeper::get().every(this, options.sync_interval, [this]() { sync(); });
         }
 
         void terminate()
         {
             locker lock(m_file_access);
 
-            if (m_file)
-            {
-                fclose(m_file);
-                m_file = nullptr;
-            }
+            m_writer->close();
         }
 
         bool ok()
         {
-            return static_cast<bool>(m_file);
+            return m_writer->is_open();
         }
 
         void write(log_message& msg) override
+        {
+            file_handle unsynced;
+
+            {
+                locker lock(m_file_access);
+
+                if (!ok())
+                    return;
+
+                put(msg);
+                commit(unsynced);
+            }
+
+            // Only whoever logged the error waits for the disk
+            if (unsynced.is_open())
+                unsynced.sync();
+        }
+
+        void write_batch(log_message* const* messages, size_t count) override
+        {
+            file_handle unsynced;
+
+            {
+                locker lock(m_file_access);
+
+                if (!ok())
+                    return;
+
+                put_batch(messages, count);
+                commit(unsynced);
+            }
+
+            if (unsynced.is_open())
+                unsynced.sync();
+        }
+
+        void flush() override
         {
             locker lock(m_file_access);
 
-            if (!ok())
-                return;
+            m_writer->flush();
+        }
 
-        #ifdef BLOGGER_UNICODE_MODE
-            size_t byte_limit = msg.size() * 2;
-            char* data; BLOGGER_STACK_ALLOC(byte_limit, data);
+        operator bool()
+        {
+            return ok();
+        }
+
+        ~file_sink()
+        {
+            {
+                locker lock(m_file_access);
+                m_closing = true;
+            }
+
+            // Finishes the renames still pending
+            housekeeper::get().cancel(this);
+
+            if (m_options.sync_mode != durability::none)
+                m_writer->sync();
+
+            m_writer->close();
+
+            if (m_next)
+            {
+                m_next->close();
+                remove_file(m_next_path);
+            }
+        }
+
+        void set_tag(in_string name) override
+        {
+            locker lock(m_file_access);
+
+            m_cached_tag = name;
+
+            if (shared())
+            {
+                m_generation = 0;
+                m_shared.open(m_directory_path + BLOGGER_WIDEN_IF_NEEDED('.') + m_cached_tag + BLOGGER_WIDEN_IF_NEEDED(".lock"));
+            }
+
+            new_log_file();
+        }
 
+    #ifdef BLOGGER_UNICODE_MODE
+        // UTF-8 for the file, returns 0 if the message couldn't be converted
+        static size_t narrow(log_message& msg, char* out, size_t byte_limit)
+        {
           #ifdef _WIN32
             auto size =
                 WideCharToMultiByte(
                     CP_UTF8, NULL,
                     msg.data(),
                     static_cast<int32_t>(msg.size()),
-                    data,
+                    out,
                     static_cast<int32_t>(byte_limit),
                     NULL, NULL
                 );
           #else
-            auto size = wcstombs(data, msg.data(), byte_limit);
+            auto size = wcstombs(out, msg.data(), byte_limit);
           #endif
 
-            if (!size || size == -1)
+            if (size == static_cast<decltype(size)>(-1))
+                return 0;
+
+            return static_cast<size_t>(size);
+        }
+    #endif
+
+    private:
+        void put(log_message& msg)
+        {
+        #ifdef BLOGGER_UNICODE_MODE
+            size_t byte_limit = msg.size() * 2;
+            char* data; BLOGGER_STACK_ALLOC(byte_limit, data);
+
+            auto size = narrow(msg, data, byte_limit);
+
+            if (!size)
                 return;
         #else
             auto* data = msg.data();
             auto  size = msg.size();
         #endif
 
-            if (m_bytes_per_file != infinite)
-            {
-                if (BLOGGER_TRUE_SIZE(size) > m_bytes_per_file)
-                    return;
+            if (shared() && !keep_up(size))
+                return;
 
-                if (m_current_bytes + BLOGGER_TRUE_SIZE(size) > m_bytes_per_file)
-                    if (!new_log_file()) return;
-            }
+            int64_t now;
+
+            if (timed() && period_over(msg, now) && !new_period(now))
+                return;
+
+            if (!make_room(size))
+                return;
 
             m_current_bytes += BLOGGER_TRUE_SIZE(size);
 
-            BLOGGER_FILE_WRITE(data, size, m_file);
+            m_writer->write(data, size);
+
+            track(msg);
         }
 
-        void flush() override
+        // Writes the whole batch with a single call,
+        // unless a new file has to be started midway
+        void put_batch(log_message* const* messages, size_t count)
         {
-            locker lock(m_file_access);
+            // Records have to reach the writer one by one
+            if (shared())
+            {
+                for (size_t i = 0; i < count; ++i)
+                    put(*messages[i]);
 
-            if (m_file)
-                fflush(m_file);
-        }
+                return;
+            }
 
-        operator bool()
-        {
-            return ok();
-        }
+            m_batch.clear();
 
-        ~file_sink()
-        {
-            if (m_file)
-                fclose(m_file);
+            for (size_t i = 0; i < count; ++i)
+            {
+                auto& msg = *messages[i];
+                size_t at = m_batch.size();
+
+            #ifdef BLOGGER_UNICODE_MODE
+                size_t byte_limit = msg.size() * 2;
+
+                m_batch.resize(at + byte_limit);
+                auto size = narrow(msg, m_batch.data() + at, byte_limit);
+                m_batch.resize(at + size);
+
+                if (!size)
+                    continue;
+            #else
+                auto size = msg.size();
+                m_batch.insert(m_batch.end(), msg.data(), msg.data() + size);
+            #endif
+
+                int64_t now;
+
+                if (timed() && period_over(msg, now))
+                {
+                    m_writer->write(m_batch.data(), at);
+                    m_batch.erase(m_batch.begin(), m_batch.begin() + at);
+                    at = 0;
+
+                    if (!new_period(now))
+                        return;
+                }
+
+                if (m_bytes_per_file != infinite)
+                {
+                    if (BLOGGER_TRUE_SIZE(size) > m_bytes_per_file)
+                    {
+                        m_batch.resize(at);
+                        continue;
+                    }
+
+                    if (m_current_bytes + BLOGGER_TRUE_SIZE(size) > m_bytes_per_file)
+                    {
+                        // The rest goes to the new file
+                        m_writer->write(m_batch.data(), at);
+                        m_batch.erase(m_batch.begin(), m_batch.begin() + at);
+
+                        if (!new_log_file())
+                            return;
+                    }
+                }
+
+                m_current_bytes += BLOGGER_TRUE_SIZE(size);
+
+                track(msg);
+            }
+
+            if (!m_batch.empty())
+                m_writer->write(m_batch.data(), m_batch.size());
         }
 
-        void set_tag(in_string name) override
+        // Whether a message of this size can be written,
+        // starts a new file if it doesn't fit in this one
+        bool make_room(size_t size)
         {
-            m_cached_tag = name;
-            new_log_file();
+            if (m_bytes_per_file == infinite)
+                return true;
+
+            if (BLOGGER_TRUE_SIZE(size) > m_bytes_per_file)
+                return false;
+
+            if (m_current_bytes + BLOGGER_TRUE_SIZE(size) > m_bytes_per_file)
+                return new_log_file();
+
+            return true;
         }
-    private:
+
         void construct_full_path(
             string& out_path
         )
@@ -135,13 +390,691 @@ namespace bl {
             out_path += m_directory_path;
             out_path += m_cached_tag;
             out_path += BLOGGER_WIDEN_IF_NEEDED('-');
-            out_path += BLOGGER_TO_STRING(m_current_log_files);
+
+            if (timed())
+            {
+                out_path += m_period;
+
+                // Only if the period needed more than one file
+                if (m_current_log_files > 1)
+                {
+                    out_path += BLOGGER_WIDEN_IF_NEEDED('-');
+                    out_path += BLOGGER_TO_STRING(m_current_log_files);
+                }
+            }
+            else
+                out_path += BLOGGER_TO_STRING(m_current_log_files);
+
             out_path += BLOGGER_WIDEN_IF_NEEDED(".log");
         }
 
-        bool new_log_file()
+        // Where the next file waits to be swapped in
+        string next_path()
+        {
+            string path = m_directory_path;
+
+            path += BLOGGER_WIDEN_IF_NEEDED('.');
+            path += m_cached_tag;
+            path += BLOGGER_WIDEN_IF_NEEDED("-next.log");
+
+            return path;
+        }
+
+        // The number new_log_file() is going to use, 0 if none
+        size_t following_index()
+        {
+            if (m_current_log_files != m_max_log_files)
+                return m_current_log_files + 1;
+
+            return m_rotate_logs ? 1 : 0;
+        }
+
+        // Has the housekeeper open the next file, if there's ever going to be one
+        void prepare_next()
+        {
+            if (shared() || (m_bytes_per_file == infinite && !timed()) || m_preparing || m_next || !m_writer->can_rename_open())
+                return;
+
+            auto index = following_index();
+
+            // The next period still needs one
+            if (!index && !timed())
+                return;
+
+            m_preparing = true;
+
+            housekeeper::get().post(this, [this, index]() { open_next(index); });
+        }
+
+        // Runs on the housekeeper
+        void open_next(size_t index)
+        {
+            string path;
+
+            {
+                locker lock(m_file_access);
+
+                if (m_closing)
+                {
+                    m_preparing = false;
+                    return;
+                }
+
+                path = next_path();
+            }
+
+            auto next = file_writer::make(m_options);
+            bool opened = next->open(path);
+
+            locker lock(m_file_access);
+
+            m_preparing = false;
+
+            if (!opened || m_closing)
+            {
+                next->close();
+                remove_file(path);
+                return;
+            }
+
+            m_next = std::move(next);
+            m_next_path = path;
+            m_next_index = index;
+        }
+
+        // Has the finished file compressed in the background
+        void retire(const string& finished)
+        {
+            if (m_options.compression && !finished.empty())
+                compressor::get().compress(m_options.compression, m_options.compression_level, finished);
+        }
+
+        // Drops the compressed copy of the file that's been taken over by a new one.
+        // Has to come after the new file exists, see compressor::compress().
+        void drop_compressed(const string& taken_over)
+        {
+            if (m_options.compression)
+                remove_file(taken_over + m_options.compression->extension());
+        }
+
+        static int64_t now()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()
+            ).count();
+        }
+
+        bool retains() const
+        {
+            return m_options.disk_budget || m_options.max_age.count();
+        }
+
+        // The number of the file called name, 0 if it isn't one of ours.
+        // Files of a period are named prefix, prefix-2 and so on.
+        size_t file_number(const string& name, const string& prefix)
         {
-            if (m_current_log_files == m_max_log_files)
+            if (name.compare(0, prefix.size(), prefix) != 0)
+                return 0;
+
+            auto end = name.find(BLOGGER_WIDEN_IF_NEEDED(".log"), prefix.size());
+
+            if (end == string::npos)
+                return 0;
+
+            auto rest = name.substr(end + 4);
+
+            if (!rest.empty() && !(m_options.compression && rest == m_options.compression->extension()))
+                return 0;
+
+            auto number = name.substr(prefix.size(), end - prefix.size());
+
+            if (timed())
+            {
+                if (number.empty())
+                    return 1;
+
+                if (number[0] != BLOGGER_WIDEN_IF_NEEDED('-'))
+                    return 0;
+
+                number.erase(0, 1);
+            }
+
+            if (number.empty() || number.size() > 9)
+                return 0;
+
+            size_t value = 0;
+
+            for (auto c : number)
+            {
+                if (c < BLOGGER_WIDEN_IF_NEEDED('0') || c > BLOGGER_WIDEN_IF_NEEDED('9'))
+                    return 0;
+
+                value = value * 10 + static_cast<size_t>(c - BLOGGER_WIDEN_IF_NEEDED('0'));
+            }
+
+            return value;
+        }
+
+        // Characters of the period stamp in file names, see start_period()
+        size_t stamp_size() const
+        {
+            auto interval = m_options.rotation_interval.count();
+
+            return interval % 86400 == 0 ? 10
+                 : interval % 60 == 0    ? 16
+                 :                         19;
+        }
+
+        static bool ends_with(const string& name, const string& suffix)
+        {
+            return name.size() >= suffix.size() &&
+                   name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+        }
+
+        // Turns the compressor's working names for path, path.N.compressing
+        // and path.N.compressing + extension, back into path. False if
+        // name looks like one but isn't.
+        bool strip_working(string& name)
+        {
+            string working = BLOGGER_WIDEN_IF_NEEDED(".compressing");
+            string partial = working + m_options.compression->extension();
+
+            if (ends_with(name, partial))
+                name.resize(name.size() - partial.size() + working.size());
+
+            if (!ends_with(name, working))
+                return true;
+
+            name.resize(name.size() - working.size());
+
+            auto dot = name.rfind(BLOGGER_WIDEN_IF_NEEDED('.'));
+
+            if (dot == string::npos || dot + 1 == name.size())
+                return false;
+
+            for (auto c : name.substr(dot + 1))
+            {
+                if (c < BLOGGER_WIDEN_IF_NEEDED('0') || c > BLOGGER_WIDEN_IF_NEEDED('9'))
+                    return false;
+            }
+
+            name.resize(dot);
+
+            return true;
+        }
+
+        // Whether name is one of our files of any period, compressed,
+        // plain, or being compressed right now
+        bool owned_file(string name, const string& prefix)
+        {
+            if (m_options.compression && !strip_working(name))
+                return false;
+
+            return file_number(name, prefix + period_of(name, prefix)) != 0;
+        }
+
+        // The period stamp right after prefix in name,
+        // empty if there is none or it doesn't rotate by time
+        string period_of(const string& name, const string& prefix)
+        {
+            static constexpr const char_t layout[] = BLOGGER_WIDEN_IF_NEEDED("0000-00-00_00-00-00");
+
+            if (!timed())
+                return string();
+
+            auto size = stamp_size();
+
+            if (name.size() < prefix.size() + size)
+                return string();
+
+            auto stamp = name.substr(prefix.size(), size);
+
+            for (size_t i = 0; i < size; ++i)
+            {
+                bool digit = stamp[i] >= BLOGGER_WIDEN_IF_NEEDED('0') && stamp[i] <= BLOGGER_WIDEN_IF_NEEDED('9');
+
+                if (digit != (layout[i] == BLOGGER_WIDEN_IF_NEEDED('0')) || (!digit && stamp[i] != layout[i]))
+                    return string();
+            }
+
+            return stamp;
+        }
+
+        // Picks up after the files a previous run left behind instead of
+        // overwriting them: after the newest one, or after the last one
+        // of the current period.
+        void resume()
+        {
+            string prefix = m_cached_tag + BLOGGER_WIDEN_IF_NEEDED('-');
+
+            if (timed())
+                prefix += m_period;
+
+            size_t index = 0;
+            int64_t newest = INT64_MIN;
+
+            for (auto& file : list_files(m_directory_path))
+            {
+                auto number = file_number(file.name, prefix);
+
+                if (!number)
+                    continue;
+
+                // Compressed copies are newer than the file they were made of
+                if (!timed() && !ends_with(file.name, BLOGGER_WIDEN_IF_NEEDED(".log")))
+                    continue;
+
+                // Files written within one timestamp tick look equally
+                // new, the later of those has the higher number
+                bool later = file.modified > newest || (file.modified == newest && number > index);
+
+                if (timed() ? number > index : later)
+                {
+                    index = number;
+                    newest = file.modified;
+                }
+            }
+
+            if (m_max_log_files != infinite && index > m_max_log_files)
+                index = m_max_log_files;
+
+            m_current_log_files = index;
+        }
+
+        // Runs on the housekeeper, deletes the oldest files
+        // until the rest fit into the budget and age limit
+        void retain()
+        {
+            string prefix;
+            string current;
+
+            {
+                locker lock(m_file_access);
+
+                prefix = m_cached_tag + BLOGGER_WIDEN_IF_NEEDED('-');
+                current = m_current_path;
+            }
+
+            auto files = list_files(m_directory_path);
+            uint64_t total = 0;
+
+            // Not other tags starting with ours, tag-io-1.log isn't one of tag's
+            files.erase(
+                std::remove_if(files.begin(), files.end(), [&](const file_entry& f) { return !owned_file(f.name, prefix); }),
+                files.end()
+            );
+
+            for (auto& file : files)
+                total += file.size;
+
+            std::sort(files.begin(), files.end(), [](const file_entry& l, const file_entry& r) {
+                return l.modified < r.modified;
+            });
+
+            auto budget = m_options.disk_budget;
+            auto oldest = m_options.max_age.count()
+                        ? now() - std::chrono::duration_cast<std::chrono::nanoseconds>(m_options.max_age).count()
+                        : INT64_MIN;
+
+            for (auto& file : files)
+            {
+                bool over_budget = budget && total > budget;
+
+                if (!over_budget && file.modified >= oldest)
+                    break;
+
+                auto path = m_directory_path + file.name;
+
+                if (path == current)
+                    continue;
+
+                if (remove_file(path))
+                    total -= file.size;
+            }
+        }
+
+        // Runs on the housekeeper. Only handing the data to the OS
+        // holds up the logging threads, the wait for the disk doesn't.
+        void sync()
+        {
+            file_handle file;
+
+            {
+                locker lock(m_file_access);
+
+                m_sync_pending = false;
+                file = m_writer->sync_handle();
+            }
+
+            if (file.is_open())
+                file.sync();
+        }
+
+        void track(log_message& msg)
+        {
+            if (m_options.sync_mode == durability::on_error && !(msg.log_level() < level::error))
+                m_unsynced_error = true;
+        }
+
+        // Done writing for now, syncs as the durability mode asks for.
+        // An error is handed to the OS here, unsynced is left for the
+        // caller to wait on once it no longer holds the lock.
+        void commit(file_handle& unsynced)
+        {
+            // Nothing waits in our buffer while the others move on
+            if (shared())
+                m_writer->flush();
+
+            switch (m_options.sync_mode)
+            {
+                case durability::on_error:
+                    if (m_unsynced_error)
+                    {
+                        unsynced = m_writer->sync_handle();
+                        m_unsynced_error = false;
+                    }
+                    break;
+                case durability::group_commit:
+                    // Everything written until it runs shares this one
+                    if (!m_sync_pending)
+                    {
+                        m_sync_pending = true;
+                        housekeeper::get().after(this, m_options.sync_interval, [this]() { sync(); });
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        bool timed() const
+        {
+            return m_options.rotation_interval.count() > 0;
+        }
+
+        // Periods longer than a day have to be whole days
+        bool valid_period() const
+        {
+            auto interval = m_options.rotation_interval.count();
+
+            return interval <= 86400 || interval % 86400 == 0;
+        }
+
+        // Local calendar days since 1970-01-01, whatever the DST changes
+        static int64_t days_since_epoch(const std::tm& date)
+        {
+            int64_t year = date.tm_year + 1900;
+            int64_t month = date.tm_mon + 1;
+
+            year -= month <= 2;
+
+            int64_t era = (year >= 0 ? year : year - 399) / 400;
+            int64_t year_of_era = year - era * 400;
+            int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + date.tm_mday - 1;
+            int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+
+            return era * 146097 + day_of_era - 719468;
+        }
+
+        // Finds the period now falls into, sets the name
+        // for its files and when the next one starts
+        void start_period(int64_t now)
+        {
+            auto interval = static_cast<time_t>(m_options.rotation_interval.count());
+            auto current = static_cast<time_t>(now / 1000000000);
+
+            std::tm day;
+            BLOGGER_UPDATE_TIME(day, current);
+
+            day.tm_hour = 0;
+            day.tm_min = 0;
+            day.tm_sec = 0;
+            day.tm_isdst = -1;
+
+            auto days = std::max<int64_t>(interval / 86400, 1);
+
+            // Periods of several days are counted from 1970-01-01,
+            // so they don't depend on when the sink was started
+            if (days > 1)
+            {
+                auto since_epoch = days_since_epoch(day);
+                auto into_period = since_epoch % days;
+
+                if (into_period < 0)
+                    into_period += days;
+
+                day.tm_mday -= static_cast<int>(into_period);
+            }
+
+            auto midnight = mktime(&day);
+
+            // Days may be 23 or 25 hours long, let mktime count them
+            std::tm following = day;
+            following.tm_mday += static_cast<int>(days);
+            following.tm_isdst = -1;
+
+            auto next_day = mktime(&following);
+
+            time_t start = midnight;
+            time_t next = next_day;
+
+            if (interval < 86400)
+            {
+                start = midnight + (current - midnight) / interval * interval;
+                next = std::min(start + interval, next_day);
+            }
+
+            std::tm local;
+            BLOGGER_UPDATE_TIME(local, start);
+
+            auto format = interval % 86400 == 0 ? BLOGGER_WIDEN_IF_NEEDED("%Y-%m-%d")
+                        : interval % 60 == 0    ? BLOGGER_WIDEN_IF_NEEDED("%Y-%m-%d_%H-%M")
+                        :                         BLOGGER_WIDEN_IF_NEEDED("%Y-%m-%d_%H-%M-%S");
+
+            char_t stamp[32];
+            auto size = BLOGGER_TIME_TO_STRING(stamp, 32, format, &local);
+
+            m_period.assign(stamp, size);
+            m_next_rotation = static_cast<int64_t>(next) * 1000000000;
+
+            // Worked out again by the next message
+            m_rotation_ticks = 0;
+        }
+
+        // Whether msg belongs to a later period, now is its time point
+        // if so. Usually decided on its raw ticks alone.
+        bool period_over(log_message& msg, int64_t& now)
+        {
+            auto& clock = msg.pattern().shared_clock();
+
+            if (clock == m_rotation_clock && msg.ticks() < m_rotation_ticks)
+                return false;
+
+            now = msg.time_point();
+
+            if (now >= m_next_rotation)
+                return true;
+
+            m_rotation_clock = clock;
+            m_rotation_ticks = clock->to_ticks(std::min(m_next_rotation - rotation_slack, now + rotation_recheck));
+
+            return false;
+        }
+
+        bool new_period(int64_t now)
+        {
+            start_period(now);
+
+            m_current_log_files = 0;
+
+            return new_log_file(true);
+        }
+
+        bool shared() const
+        {
+            return m_options.shared;
+        }
+
+        // Follows other processes to their new file and keeps
+        // the byte count up with what they've written
+        bool keep_up(size_t size)
+        {
+            if (m_shared.generation() != m_generation)
+            {
+                if (!m_shared.lock())
+                    return false;
+
+                bool ok = follow();
+                m_shared.unlock();
+
+                return ok;
+            }
+
+            m_unchecked_bytes += size;
+
+            if (m_unchecked_bytes >= m_options.atomic_write_size)
+            {
+                m_unchecked_bytes = 0;
+                m_current_bytes = static_cast<size_t>(m_writer->shared_size());
+            }
+
+            return true;
+        }
+
+        // new_log_file() for files shared with other processes. Whoever
+        // gets the lock first starts the new file, the rest follow it.
+        bool shared_new_log_file(bool period_changed)
+        {
+            if (!m_shared.is_open() || !m_shared.lock())
+                return false;
+
+            bool ok = advance(period_changed);
+            m_shared.unlock();
+
+            return ok;
+        }
+
+        // Holding the lock
+        bool advance(bool period_changed)
+        {
+            auto& state = m_shared.get();
+            auto generation = m_shared.generation();
+
+            if (timed() && m_current_path.empty())
+                start_period(now());
+
+            bool same_period = !timed() || state.next_rotation >= m_next_rotation;
+
+            if (generation && generation != m_generation && same_period)
+                return follow();
+
+            if (!generation)
+                resume();
+            else if (period_changed || !same_period)
+                m_current_log_files = 0;
+            else
+                m_current_log_files = static_cast<size_t>(state.index);
+
+            if (m_max_log_files != infinite && m_current_log_files == m_max_log_files)
+            {
+                if (!m_rotate_logs)
+                    return false;
+
+                m_current_log_files = 1;
+            }
+            else
+                ++m_current_log_files;
+
+            string fullPath;
+            construct_full_path(fullPath);
+
+            auto name = fullPath.substr(m_directory_path.size());
+
+            if (name.size() >= sizeof(state.name) / sizeof(char_t))
+                return false;
+
+            // An old file with the same number
+            remove_file(fullPath);
+
+            if (m_options.sync_mode != durability::none)
+                m_writer->sync();
+
+            if (!m_writer->open(fullPath))
+                return false;
+
+            std::char_traits<char_t>::copy(state.name, name.c_str(), name.size());
+            state.name[name.size()] = BLOGGER_WIDEN_IF_NEEDED('\0');
+            state.index = m_current_log_files;
+            state.next_rotation = m_next_rotation;
+            state.generation.store(generation + 1, std::memory_order_release);
+
+            m_generation = generation + 1;
+            switched_to(fullPath);
+
+            return true;
+        }
+
+        // Holding the lock
+        bool follow()
+        {
+            auto& state = m_shared.get();
+            auto path = m_directory_path + state.name;
+
+            if (m_options.sync_mode != durability::none)
+                m_writer->sync();
+
+            if (!m_writer->open(path))
+                return false;
+
+            m_generation = m_shared.generation();
+            m_current_log_files = static_cast<size_t>(state.index);
+
+            // Its period, in case we haven't got there yet
+            if (timed() && state.next_rotation != m_next_rotation)
+                start_period(state.next_rotation - 1);
+
+            switched_to(path);
+
+            return true;
+        }
+
+        void switched_to(const string& path)
+        {
+            m_current_path = path;
+            m_current_bytes = static_cast<size_t>(m_writer->shared_size());
+            m_unchecked_bytes = 0;
+            m_unsynced_error = false;
+
+            if (retains())
+                housekeeper::get().post(this, [this]() { retain(); });
+        }
+
+        bool new_log_file(bool period_changed = false)
+        {
+            // No files at all rather than periods nobody asked for
+            if (timed() && !valid_period())
+                return false;
+
+            if (shared())
+                return shared_new_log_file(period_changed);
+
+            // The very first file
+            if (m_current_path.empty())
+            {
+                if (timed())
+                    start_period(now());
+
+                resume();
+            }
+
+            // Can't wait for the new file to be synced
+            if (m_unsynced_error)
+            {
+                m_writer->sync();
+                m_unsynced_error = false;
+            }
+
+            if (m_max_log_files != infinite && m_current_log_files == m_max_log_files)
             {
                 if (!m_rotate_logs)
                     return false;
@@ -157,18 +1090,75 @@ namespace bl {
                 ++m_current_log_files;
             }
 
-            if (m_file)
+            string fullPath;
+            construct_full_path(fullPath);
+
+            if (m_next && (period_changed || m_next_index == m_current_log_files))
             {
-                fclose(m_file);
-                m_file = nullptr;
+                std::shared_ptr<file_writer> previous(std::move(m_writer));
+                auto temporary = m_next_path;
+                auto finished = m_current_path;
+                m_writer = std::move(m_next);
+
+                housekeeper::get().post(this, [this, previous, temporary, finished, fullPath]() {
+                    if (m_options.sync_mode != durability::none)
+                        previous->sync();
+
+                    previous->close();
+
+                    // Before the rename, the finished file may have the same name
+                    retire(finished);
+
+                    rename_file(temporary, fullPath);
+                    drop_compressed(fullPath);
+                });
             }
+            else
+            {
+                // The first file, or the housekeeper is behind
+                if (m_next)
+                {
+                    m_next->close();
+                    m_next.reset();
+                    remove_file(m_next_path);
+                }
 
-            string fullPath;
-            construct_full_path(fullPath);
+                if (m_options.sync_mode != durability::none)
+                    m_writer->sync();
+
+                m_writer->close();
+
+                // Only if the new file is about to take its name,
+                // otherwise the housekeeper does it
+                if (m_current_path == fullPath)
+                    retire(m_current_path);
+                else if (m_options.compression && !m_current_path.empty())
+                {
+                    auto finished = m_current_path;
+
+                    housekeeper::get().post(this, [this, finished]() {
+                        locker lock(m_file_access);
+
+                        // Unless it's been started over in the meantime
+                        if (finished != m_current_path)
+                            retire(finished);
+                    });
+                }
+
+                if (!m_writer->open(fullPath))
+                    return false;
+
+                drop_compressed(fullPath);
+            }
+
+            m_current_path = fullPath;
+
+            prepare_next();
 
-            BLOGGER_OPEN_FILE(m_file, fullPath);
+            if (retains())
+                housekeeper::get().post(this, [this]() { retain(); });
 
-            return m_file;
+            return true;
         }
     };
 }
@@ -0,0 +1,774 @@
+#pragma once
+
+#include <stdio.h>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "blogger/core.h"
+#include "blogger/os/functions.h"
+#include "blogger/os/file.h"
+#include "blogger/os/uring.h"
+#include "blogger/sinks/file_options.h"
+
+#ifdef _WIN32
+    #include <io.h>
+#endif
+
+namespace bl {
+
+    // Where a file sink's bytes go, one file at a time.
+    // Not thread safe, the sink serializes all calls.
+    class file_writer
+    {
+    public:
+        using ptr = std::unique_ptr<file_writer>;
+
+        static ptr make(const file_options& options);
+
+        // Closes the current file first
+        virtual bool open(const string& path) = 0;
+
+        virtual bool is_open() const = 0;
+
+        virtual bool write(const char* data, size_t size) = 0;
+
+        // Hands everything written so far to the OS
+        virtual void flush() = 0;
+
+        // Flushes and waits until it's all on stable storage
+        virtual bool sync() = 0;
+
+        // Hands everything written so far to the OS and returns a
+        // handle of its own to the file, which can be synced without
+        // holding up the writer. Invalid if there's no file or
+        // handing it over failed.
+        virtual file_handle sync_handle() = 0;
+
+        virtual void close() = 0;
+
+        // Whether the file may be renamed while it's open
+        virtual bool can_rename_open() const
+        {
+            return true;
+        }
+
+        // Bytes in the file so far, other processes' writes included.
+        // Only writers of files shared between processes know it.
+        virtual uint64_t shared_size()
+        {
+            return 0;
+        }
+
+        virtual ~file_writer() = default;
+    };
+
+    // Leaves buffering to stdio
+    class stdio_writer : public file_writer
+    {
+    private:
+        FILE* m_file;
+    public:
+        stdio_writer()
+            : m_file(nullptr)
+        {
+        }
+
+        bool open(const string& path) override
+        {
+            close();
+
+            BLOGGER_OPEN_FILE(m_file, path);
+
+            return m_file;
+        }
+
+        bool is_open() const override
+        {
+            return m_file;
+        }
+
+        bool write(const char* data, size_t size) override
+        {
+            return BLOGGER_FILE_WRITE(data, size, m_file) == size;
+        }
+
+        void flush() override
+        {
+            if (m_file)
+                fflush(m_file);
+        }
+
+        bool sync() override
+        {
+            if (!m_file || fflush(m_file) != 0)
+                return false;
+
+          #ifdef _WIN32
+            return _commit(_fileno(m_file)) == 0;
+          #elif defined(__linux__)
+            return fdatasync(fileno(m_file)) == 0;
+          #else
+            return fsync(fileno(m_file)) == 0;
+          #endif
+        }
+
+        file_handle sync_handle() override
+        {
+            if (!m_file || fflush(m_file) != 0)
+                return file_handle();
+
+          #ifdef _WIN32
+            auto handle = reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(m_file)));
+          #else
+            auto handle = fileno(m_file);
+          #endif
+
+            return file_handle::duplicate(handle);
+        }
+
+        void close() override
+        {
+            if (m_file)
+            {
+                fclose(m_file);
+                m_file = nullptr;
+            }
+        }
+
+      #ifdef _WIN32
+        // Files opened by stdio aren't shared for deletion
+        bool can_rename_open() const override
+        {
+            return false;
+        }
+      #endif
+
+        ~stdio_writer()
+        {
+            close();
+        }
+    };
+
+    // Collects writes in its own aligned buffer and hands them to
+    // an O_APPEND file descriptor in large chunks. A write that
+    // doesn't fit goes out together with the buffer in one writev.
+    class buffered_writer : public file_writer
+    {
+    private:
+        file_handle    m_file;
+        file_mode      m_mode;
+        aligned_buffer m_buffer;
+        size_t         m_used;
+        size_t         m_flush_bytes;
+    public:
+        // mode is either file_mode::truncate or file_mode::append
+        buffered_writer(size_t buffer_size, size_t flush_bytes, file_mode mode = file_mode::truncate)
+            : m_file(),
+              m_mode(mode),
+              m_buffer(),
+              m_used(0),
+              m_flush_bytes(0)
+        {
+            m_buffer.allocate(buffer_size);
+
+            m_flush_bytes = flush_bytes && flush_bytes < m_buffer.size()
+                          ? flush_bytes
+                          : m_buffer.size();
+        }
+
+        bool open(const string& path) override
+        {
+            close();
+
+            return m_file.open(path, m_mode);
+        }
+
+        bool is_open() const override
+        {
+            return m_file.is_open();
+        }
+
+        bool write(const char* data, size_t size) override
+        {
+            if (m_used + size > m_buffer.size())
+            {
+                bool ok = m_file.write(m_buffer.data(), m_used, data, size);
+                m_used = 0;
+
+                return ok;
+            }
+
+            std::memcpy(m_buffer.data() + m_used, data, size);
+            m_used += size;
+
+            if (m_used >= m_flush_bytes)
+                return write_out();
+
+            return true;
+        }
+
+        void flush() override
+        {
+            write_out();
+        }
+
+        bool sync() override
+        {
+            return m_file.is_open() && write_out() && m_file.sync();
+        }
+
+        file_handle sync_handle() override
+        {
+            if (!m_file.is_open() || !write_out())
+                return file_handle();
+
+            return m_file.duplicate();
+        }
+
+        void close() override
+        {
+            if (!m_file.is_open())
+                return;
+
+            write_out();
+            m_file.close();
+        }
+
+        ~buffered_writer()
+        {
+            close();
+        }
+    private:
+        bool write_out()
+        {
+            if (!m_used)
+                return true;
+
+            bool ok = m_file.write(m_buffer.data(), m_used);
+            m_used = 0;
+
+            return ok;
+        }
+    };
+
+    // Copies writes straight into a shared mapping of the file, one
+    // window at a time. Disk space for a window is reserved before
+    // it's mapped, so writing never needs a syscall until the window
+    // is full. The file is cut down to what was written on close.
+    class mapped_writer : public file_writer
+    {
+    private:
+        file_handle m_file;
+        file_view   m_view;
+        size_t      m_window_size;
+        uint64_t    m_window_offset;
+        size_t      m_used;
+    public:
+        explicit mapped_writer(size_t window_size)
+            : m_file(),
+              m_view(),
+              m_window_size(0),
+              m_window_offset(0),
+              m_used(0)
+        {
+            auto granularity = file_view::granularity();
+
+            m_window_size = (window_size + granularity - 1) / granularity * granularity;
+        }
+
+        bool open(const string& path) override
+        {
+            close();
+
+            if (!m_file.open(path, file_mode::random_access))
+                return false;
+
+            m_window_offset = 0;
+            m_used = 0;
+
+            if (!map_window())
+            {
+                m_file.close();
+                return false;
+            }
+
+            return true;
+        }
+
+        bool is_open() const override
+        {
+            return m_file.is_open();
+        }
+
+        bool write(const char* data, size_t size) override
+        {
+            while (size)
+            {
+                if (m_used == m_view.size())
+                {
+                    m_window_offset += m_view.size();
+                    m_used = 0;
+
+                    if (!map_window())
+                        return false;
+                }
+
+                auto chunk = std::min(size, m_view.size() - m_used);
+
+                std::memcpy(m_view.data() + m_used, data, chunk);
+
+                m_used += chunk;
+                data += chunk;
+                size -= chunk;
+            }
+
+            return true;
+        }
+
+        // Already in the page cache
+        void flush() override
+        {
+        }
+
+        // Earlier windows are unmapped, syncing the file covers them
+        bool sync() override
+        {
+            return m_file.is_open() && m_view.sync(m_used) && m_file.sync();
+        }
+
+        file_handle sync_handle() override
+        {
+            if (!m_file.is_open() || !m_view.sync(m_used, false))
+                return file_handle();
+
+            return m_file.duplicate();
+        }
+
+        void close() override
+        {
+            if (!m_file.is_open())
+                return;
+
+            m_view.unmap();
+            m_file.resize(m_window_offset + m_used);
+            m_file.close();
+        }
+
+        ~mapped_writer()
+        {
+            close();
+        }
+    private:
+        bool map_window()
+        {
+            m_view.unmap();
+
+            return m_file.reserve(m_window_offset, m_window_size) &&
+                   m_view.map(m_file, m_window_offset, m_window_size);
+        }
+    };
+
+    // For files several processes append to at once. The sink hands
+    // it whole records, and every write appends whole records and is
+    // no larger than write_limit, unless one record is larger on its
+    // own. That keeps records of different processes from interleaving.
+    class shared_writer : public file_writer
+    {
+    private:
+        file_handle       m_file;
+        std::vector<char> m_buffer;
+        size_t            m_used;
+    public:
+        explicit shared_writer(size_t write_limit)
+            : m_file(),
+              m_buffer(write_limit),
+              m_used(0)
+        {
+        }
+
+        // Never truncates, other processes may be writing to it already
+        bool open(const string& path) override
+        {
+            close();
+
+            return m_file.open(path, file_mode::append);
+        }
+
+        bool is_open() const override
+        {
+            return m_file.is_open();
+        }
+
+        bool write(const char* data, size_t size) override
+        {
+            if (m_used + size > m_buffer.size() && !write_out())
+                return false;
+
+            if (size >= m_buffer.size())
+                return m_file.write(data, size);
+
+            std::memcpy(m_buffer.data() + m_used, data, size);
+            m_used += size;
+
+            return true;
+        }
+
+        void flush() override
+        {
+            write_out();
+        }
+
+        bool sync() override
+        {
+            return m_file.is_open() && write_out() && m_file.sync();
+        }
+
+        file_handle sync_handle() override
+        {
+            if (!m_file.is_open() || !write_out())
+                return file_handle();
+
+            return m_file.duplicate();
+        }
+
+        uint64_t shared_size() override
+        {
+            return m_file.size() + m_used;
+        }
+
+        void close() override
+        {
+            if (!m_file.is_open())
+                return;
+
+            write_out();
+            m_file.close();
+        }
+
+        ~shared_writer()
+        {
+            close();
+        }
+    private:
+        bool write_out()
+        {
+            if (!m_used)
+                return true;
+
+            bool ok = m_file.write(m_buffer.data(), m_used);
+            m_used = 0;
+
+            return ok;
+        }
+    };
+
+#ifdef BLOGGER_HAS_IO_URING
+    // Hands full buffers to the kernel through io_uring and moves on
+    // to the next one while they're written, so a slow disk doesn't
+    // hold up the sink until every buffer is in flight. Writes go to
+    // explicit offsets, they may complete in any order.
+    class uring_writer : public file_writer
+    {
+    private:
+        struct slot
+        {
+            aligned_buffer buffer;
+            uint64_t       offset  = 0;
+            size_t         used    = 0;
+            size_t         written = 0;
+            bool           busy    = false;
+        };
+
+        io_ring                 m_ring;
+        file_handle             m_file;
+        std::unique_ptr<slot[]> m_slots;
+        size_t                  m_slot_count;
+        size_t                  m_current;
+        size_t                  m_in_flight;
+        uint64_t                m_offset;
+        bool                    m_failed;
+
+        // The kernel may still be using the file and buffers
+        bool                    m_abandoned;
+    public:
+        uring_writer(size_t buffer_size, size_t buffer_count)
+            : m_ring(),
+              m_file(),
+              m_slots(new slot[buffer_count < 2 ? 2 : buffer_count]),
+              m_slot_count(buffer_count < 2 ? 2 : buffer_count),
+              m_current(0),
+              m_in_flight(0),
+              m_offset(0),
+              m_failed(false),
+              m_abandoned(false)
+        {
+            for (size_t i = 0; i < m_slot_count; ++i)
+                m_slots[i].buffer.allocate(buffer_size);
+        }
+
+        // nullptr if io_uring isn't available
+        static std::unique_ptr<uring_writer> try_make(size_t buffer_size, size_t buffer_count)
+        {
+            auto writer = std::make_unique<uring_writer>(buffer_size, buffer_count);
+
+            // Room for a retry of every buffer
+            if (!writer->m_ring.setup(static_cast<unsigned>(writer->m_slot_count * 2)))
+                return nullptr;
+
+            for (size_t i = 0; i < writer->m_slot_count; ++i)
+            {
+                if (!writer->m_slots[i].buffer.size())
+                    return nullptr;
+            }
+
+            return writer;
+        }
+
+        bool open(const string& path) override
+        {
+            close();
+
+            if (m_abandoned)
+                return false;
+
+            // Whatever a failed file left behind is gone with it
+            for (size_t i = 0; i < m_slot_count; ++i)
+            {
+                m_slots[i].used = 0;
+                m_slots[i].written = 0;
+                m_slots[i].busy = false;
+            }
+
+            m_current = 0;
+            m_in_flight = 0;
+            m_offset = 0;
+            m_failed = false;
+
+            return m_file.open(path, file_mode::random_access);
+        }
+
+        bool is_open() const override
+        {
+            return m_file.is_open();
+        }
+
+        bool write(const char* data, size_t size) override
+        {
+            while (size && !m_failed)
+            {
+                auto& current = m_slots[m_current];
+                auto chunk = std::min(size, current.buffer.size() - current.used);
+
+                std::memcpy(current.buffer.data() + current.used, data, chunk);
+
+                current.used += chunk;
+                data += chunk;
+                size -= chunk;
+
+                if (current.used == current.buffer.size())
+                    submit_current();
+            }
+
+            return !m_failed;
+        }
+
+        // Submits what's buffered without waiting for it
+        void flush() override
+        {
+            if (m_slots[m_current].used && !m_failed)
+                submit_current();
+
+            reap();
+        }
+
+        bool sync() override
+        {
+            if (!m_file.is_open())
+                return false;
+
+            flush();
+
+            while (m_in_flight && !m_failed)
+                wait_one();
+
+            return !m_failed && m_file.sync();
+        }
+
+        // Waits for the writes in flight, they only reach the page cache
+        file_handle sync_handle() override
+        {
+            if (!m_file.is_open())
+                return file_handle();
+
+            flush();
+
+            while (m_in_flight && !m_failed)
+                wait_one();
+
+            if (m_failed)
+                return file_handle();
+
+            return m_file.duplicate();
+        }
+
+        void close() override
+        {
+            if (!m_file.is_open())
+                return;
+
+            flush();
+
+            // An fd closed under a write in flight may be
+            // reused by then, so it's left open if that happens
+            if (!drain())
+            {
+                m_abandoned = true;
+                m_file.release();
+
+                return;
+            }
+
+            m_file.close();
+        }
+
+        ~uring_writer()
+        {
+            close();
+
+            // Leaked rather than freed under the kernel
+            if (m_abandoned)
+                m_slots.release();
+        }
+    private:
+        void submit(size_t index)
+        {
+            auto& s = m_slots[index];
+
+            s.busy = true;
+            ++m_in_flight;
+
+            m_ring.prepare_write(
+                m_file.get(),
+                s.buffer.data() + s.written,
+                s.used - s.written,
+                s.offset + s.written,
+                index
+            );
+
+            if (!m_ring.enter())
+                m_failed = true;
+        }
+
+        void submit_current()
+        {
+            auto& current = m_slots[m_current];
+
+            current.offset = m_offset;
+            current.written = 0;
+            m_offset += current.used;
+
+            submit(m_current);
+
+            // Waits for the disk only if every buffer is in flight
+            for (;;)
+            {
+                reap();
+
+                for (size_t i = 1; i <= m_slot_count; ++i)
+                {
+                    auto next = (m_current + i) % m_slot_count;
+
+                    if (!m_slots[next].busy)
+                    {
+                        m_current = next;
+                        return;
+                    }
+                }
+
+                if (m_failed)
+                    return;
+
+                wait_one();
+            }
+        }
+
+        // Waits for every write the kernel has, failed ones
+        // included. False if the ring stopped working.
+        bool drain()
+        {
+            while (m_in_flight)
+            {
+                if (!m_ring.enter(1) && errno != EAGAIN && errno != EBUSY)
+                    return false;
+
+                reap();
+            }
+
+            return true;
+        }
+
+        void wait_one()
+        {
+            if (!m_ring.enter(1))
+                m_failed = true;
+
+            reap();
+        }
+
+        void reap()
+        {
+            io_ring::completion done;
+
+            while (m_ring.pop(done))
+            {
+                auto index = static_cast<size_t>(done.user_data);
+                auto& s = m_slots[index];
+
+                --m_in_flight;
+
+                if (done.result > 0)
+                {
+                    s.written += static_cast<size_t>(done.result);
+
+                    // Short write, send the rest
+                    if (s.written < s.used)
+                    {
+                        submit(index);
+                        continue;
+                    }
+                }
+                else
+                    m_failed = true;
+
+                s.used = 0;
+                s.busy = false;
+            }
+        }
+    };
+#endif
+
+    inline file_writer::ptr file_writer::make(const file_options& options)
+    {
+        if (options.shared)
+            return std::make_unique<shared_writer>(options.atomic_write_size);
+
+        // Takes precedence over any kind of buffering
+        if (options.map_size)
+            return std::make_unique<mapped_writer>(options.map_size);
+
+      #ifdef BLOGGER_HAS_IO_URING
+        if (options.buffer_size && options.in_flight_buffers)
+        {
+            if (auto writer = uring_writer::try_make(options.buffer_size, options.in_flight_buffers))
+                return writer;
+        }
+      #endif
+
+        if (options.buffer_size)
+            return std::make_unique<buffered_writer>(options.buffer_size, options.flush_bytes);
+
+        return std::make_unique<stdio_writer>();
+    }
+}
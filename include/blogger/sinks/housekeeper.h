@@ -0,0 +1,197 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <vector>
+
+#include "blogger/core.h"
+#include "blogger/sinks/compressor.h"
+
+namespace bl {
+
+    // A single background thread for the upkeep of sinks, so that
+    // none of it has to happen on the logging path. Every job has
+    // an owner, usually the sink that posted it, which has to call
+    // cancel() before it goes away. Jobs run one at a time in the
+    // order they're due and may post further jobs.
+    class housekeeper
+    {
+    public:
+        using job = std::function<void()>;
+        using clock = std::chrono::steady_clock;
+    private:
+        struct entry
+        {
+            const void*       owner;
+            job               work;
+            clock::duration   interval;
+            clock::time_point next_run;
+            bool              periodic;
+        };
+
+        std::vector<entry>      m_jobs;
+        std::mutex              m_access;
+        std::condition_variable m_notifier;
+        std::condition_variable m_job_done;
+        const void*             m_running_owner;
+        bool                    m_running;
+        std::thread             m_thread;
+    private:
+        housekeeper()
+            : m_running_owner(nullptr),
+              m_running(true)
+        {
+            // Jobs hand files over to it, so it has to outlive us
+            compressor::get();
+
+            m_thread = std::thread([this]() { worker(); });
+        }
+
+        housekeeper(const housekeeper& other) = delete;
+        housekeeper& operator=(const housekeeper& other) = delete;
+
+        void worker()
+        {
+            std::unique_lock<std::mutex> lock(m_access);
+
+            while (m_running)
+            {
+                auto now = clock::now();
+                auto wake_up = now + std::chrono::seconds(1);
+                size_t due = m_jobs.size();
+
+                for (size_t i = 0; i < m_jobs.size(); ++i)
+                {
+                    if (m_jobs[i].next_run <= now)
+                    {
+                        due = i;
+                        break;
+                    }
+
+                    if (m_jobs[i].next_run < wake_up)
+                        wake_up = m_jobs[i].next_run;
+                }
+
+                if (due == m_jobs.size())
+                {
+                    m_notifier.wait_until(lock, wake_up);
+                    continue;
+                }
+
+                job work;
+                auto& e = m_jobs[due];
+
+                m_running_owner = e.owner;
+
+                if (e.periodic)
+                {
+                    work = e.work;
+                    e.next_run = now + e.interval;
+                }
+                else
+                {
+                    work = std::move(e.work);
+                    m_jobs.erase(m_jobs.begin() + due);
+                }
+
+                lock.unlock();
+
+                work();
+
+                lock.lock();
+                m_running_owner = nullptr;
+                m_job_done.notify_all();
+            }
+        }
+
+        void add(const void* owner, job work, clock::duration interval, bool periodic)
+        {
+            locker lock(m_access);
+
+            m_jobs.push_back({ owner, std::move(work), interval, clock::now() + interval, periodic });
+
+            m_notifier.notify_one();
+        }
+    public:
+        static housekeeper& get()
+        {
+            static housekeeper instance;
+
+            return instance;
+        }
+
+        // Runs work every interval until the owner cancels it
+        void every(const void* owner, std::chrono::milliseconds interval, job work)
+        {
+            add(owner, std::move(work), interval, true);
+        }
+
+        // Runs work once, as soon as possible
+        void post(const void* owner, job work)
+        {
+            add(owner, std::move(work), clock::duration::zero(), false);
+        }
+
+        // Runs work once, after delay
+        void after(const void* owner, std::chrono::milliseconds delay, job work)
+        {
+            add(owner, std::move(work), delay, false);
+        }
+
+        // Drops the owner's periodic jobs and runs the ones it posted
+        // right away on the calling thread instead. Once this returns
+        // none of its jobs is running and none is left.
+        void cancel(const void* owner)
+        {
+            std::vector<job> pending;
+
+            // The pending jobs may post more of their own
+            do
+            {
+                for (auto& work : pending)
+                    work();
+
+                pending.clear();
+
+                std::unique_lock<std::mutex> lock(m_access);
+
+                if (std::this_thread::get_id() != m_thread.get_id())
+                    m_job_done.wait(lock, [&]() { return m_running_owner != owner; });
+
+                for (size_t i = 0; i < m_jobs.size();)
+                {
+                    if (m_jobs[i].owner == owner)
+                    {
+                        if (!m_jobs[i].periodic)
+                            pending.push_back(std::move(m_jobs[i].work));
+
+                        m_jobs.erase(m_jobs.begin() + i);
+                    }
+                    else
+                        ++i;
+                }
+            } while (!pending.empty());
+        }
+
+        ~housekeeper()
+        {
+            {
+                locker lock(m_access);
+                m_running = false;
+            }
+
+            m_notifier.notify_one();
+            m_thread.join();
+
+            // Whatever was posted still has to happen
+            for (auto& e : m_jobs)
+            {
+                if (!e.periodic)
+                    e.work();
+            }
+        }
+    };
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "blogger/core.h"
+#include "blogger/os/file.h"
+
+namespace bl {
+
+    // Lets processes that log to the same files take turns starting
+    // new ones. Whoever holds the lock starts the next file and
+    // records it here, everyone else follows. The lock file is
+    // mapped into every process, so checking for a new file
+    // is a single load.
+    class rotation_lock
+    {
+    public:
+        struct state
+        {
+            // Bumped for every new file, 0 until there's one
+            std::atomic<uint64_t> generation;
+
+            // When the file's period ends, for time based rotation
+            int64_t               next_rotation;
+
+            // The file's number and its name within the directory
+            uint64_t              index;
+            char_t                name[256];
+        };
+    private:
+        file_handle m_file;
+        file_view   m_view;
+    public:
+        rotation_lock() = default;
+
+        rotation_lock(const rotation_lock& other) = delete;
+        rotation_lock& operator=(const rotation_lock& other) = delete;
+
+        bool open(const string& path)
+        {
+            close();
+
+            if (!m_file.open(path, file_mode::update))
+                return false;
+
+            // Whoever creates it gets to size it, it's all zeroes until then
+            if (m_file.size() < sizeof(state))
+            {
+                m_file.lock();
+
+                if (m_file.size() < sizeof(state))
+                    m_file.resize(sizeof(state));
+
+                m_file.unlock();
+            }
+
+            if (!m_view.map(m_file, 0, sizeof(state)))
+            {
+                m_file.close();
+                return false;
+            }
+
+            return true;
+        }
+
+        bool is_open() const
+        {
+            return m_file.is_open();
+        }
+
+        // Of the file that's being written to, may be read without the lock
+        uint64_t generation()
+        {
+            return get().generation.load(std::memory_order_acquire);
+        }
+
+        // Only to be changed while holding the lock
+        state& get()
+        {
+            return *reinterpret_cast<state*>(m_view.data());
+        }
+
+        bool lock()
+        {
+            return m_file.lock();
+        }
+
+        void unlock()
+        {
+            m_file.unlock();
+        }
+
+        void close()
+        {
+            m_view.unmap();
+            m_file.close();
+        }
+
+        ~rotation_lock()
+        {
+            close();
+        }
+    };
+}
@@ -0,0 +1,376 @@
+#pragma once
+
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "blogger/sinks/sink.h"
+#include "blogger/sinks/file_sink.h"
+#include "blogger/sinks/file_writer.h"
+#include "blogger/sinks/housekeeper.h"
+
+namespace bl {
+
+    // Writes every message to <directory>/<tag>.log, with the tag of
+    // the logger it came from, so that any number of loggers can
+    // share one sink. Files are opened when they're first needed and
+    // appended to. Only the max_open_files most recently used ones
+    // stay open, each with a buffer of its own.
+    // Honors buffer_size, flush_bytes, flush_interval, sync_mode and
+    // shared. Options that need a file of its own (map_size) or rotated
+    // files (rotation_interval, compression, disk_budget, max_age) are
+    // rejected: the sink doesn't open any file then. in_flight_buffers
+    // falls back to a single buffer as if io_uring wasn't there.
+    class routing_file_sink : public sink
+    {
+    private:
+        struct open_file
+        {
+            // The tag it was opened for and its file name,
+            // tags that differ in unsafe characters share a file
+            string           tag;
+            string           name;
+            file_writer::ptr writer;
+
+            // An error was written since it was last synced
+            bool             unsynced_error;
+        };
+
+        using lru_list = std::list<open_file>;
+
+        file_options       m_options;
+        string             m_directory_path;
+        size_t             m_max_open_files;
+
+        // Most recently used first, looked up by file name
+        lru_list           m_files;
+        std::unordered_map<string, lru_list::iterator> m_by_tag;
+
+        // Consecutive messages mostly come from the same logger
+        open_file*         m_last;
+
+        bool               m_supported;
+        bool               m_sync_pending;
+
+        // Some open file has an unsynced error
+        bool               m_unsynced_error;
+
+        std::mutex         m_access;
+    public:
+        routing_file_sink(
+            in_string directory_path,
+            size_t max_open_files = 64,
+            const file_options& options = file_options()
+        ) : m_options(options),
+            m_directory_path(directory_path),
+            m_max_open_files(max_open_files ? max_open_files : 1),
+            m_files(),
+            m_by_tag(),
+            m_last(nullptr),
+            m_supported(supports(options)),
+            m_sync_pending(false),
+            m_unsynced_error(false),
+            m_access()
+        {
+            // Empty means the working directory
+            if (!m_directory_path.empty() && m_directory_path.back() != BLOGGER_WIDEN_IF_NEEDED('/'))
+                m_directory_path += '/';
+
+            if (!m_options.buffer_size)
+                m_options.buffer_size = 64 * 1024;
+
+            if (!m_supported)
+                return;
+
+            if (m_options.flush_interval.count())
+            {
+                housekeeper::get().every(
+                    this,
+                    m_options.flush_interval,
+                    [this]() { flush(); }
+                );
+            }
+
+            if (m_options.sync_mode == durability::periodic)
+                housekeeper::get().every(this, m_options.sync_interval, [this]() { sync(); });
+        }
+
+        // False if it was given options it can't honor
+        bool ok() const
+        {
+            return m_supported;
+        }
+
+        static bool supports(const file_options& options)
+        {
+            return !options.map_size &&
+                   !options.rotation_interval.count() &&
+                   !options.compression &&
+                   !options.disk_budget &&
+                   !options.max_age.count();
+        }
+
+        // One sink per directory, loggers that ask for the same one share it.
+        // Whoever asks first decides its limit and options.
+        static std::shared_ptr<routing_file_sink> get(
+            in_string directory_path,
+            size_t max_open_files = 64,
+            const file_options& options = file_options())
+        {
+            static std::mutex access;
+            static std::unordered_map<string, std::weak_ptr<routing_file_sink>> sinks;
+
+            string key(directory_path);
+
+            if (!key.empty() && key.back() != BLOGGER_WIDEN_IF_NEEDED('/'))
+                key += '/';
+
+            locker lock(access);
+
+            auto& existing = sinks[key];
+            auto shared = existing.lock();
+
+            if (!shared)
+            {
+                shared = std::make_shared<routing_file_sink>(key, max_open_files, options);
+                existing = shared;
+            }
+
+            return shared;
+        }
+
+        void write(log_message& msg) override
+        {
+            std::vector<file_handle> unsynced;
+
+            {
+                locker lock(m_access);
+
+                put(msg, unsynced);
+                commit(unsynced);
+            }
+
+            // Only whoever logged the error waits for the disk
+            for (auto& handle : unsynced)
+                handle.sync();
+        }
+
+        void write_batch(log_message* const* messages, size_t count) override
+        {
+            std::vector<file_handle> unsynced;
+
+            {
+                locker lock(m_access);
+
+                for (size_t i = 0; i < count; ++i)
+                    put(*messages[i], unsynced);
+
+                commit(unsynced);
+            }
+
+            for (auto& handle : unsynced)
+                handle.sync();
+        }
+
+        void flush() override
+        {
+            locker lock(m_access);
+
+            for (auto& file : m_files)
+                file.writer->flush();
+        }
+
+        // Files are named after the tag of every message instead
+        void set_tag(in_string) override
+        {
+        }
+
+        ~routing_file_sink()
+        {
+            housekeeper::get().cancel(this);
+
+            if (m_options.sync_mode == durability::none)
+                return;
+
+            for (auto& file : m_files)
+                file.writer->sync();
+        }
+
+        // A file name made of tag that stays in the directory and is
+        // valid on windows too: no separators, control characters,
+        // reserved characters or leading dots
+        static string file_name(const string& tag)
+        {
+            static const char_t reserved[] = BLOGGER_WIDEN_IF_NEEDED("/\\:*?\"<>|");
+
+            string name = tag;
+
+            for (auto& c : name)
+            {
+                if (std::char_traits<char_t>::find(reserved, sizeof(reserved) / sizeof(char_t) - 1, c) ||
+                    static_cast<unsigned>(c) < 32)
+                    c = BLOGGER_WIDEN_IF_NEEDED('_');
+            }
+
+            if (name.empty() || name[0] == BLOGGER_WIDEN_IF_NEEDED('.'))
+                name.insert(name.begin(), BLOGGER_WIDEN_IF_NEEDED('_'));
+
+            return name + BLOGGER_WIDEN_IF_NEEDED(".log");
+        }
+    private:
+        // unsynced collects files that have to be synced once the lock is let go of
+        void put(log_message& msg, std::vector<file_handle>& unsynced)
+        {
+            auto* file = file_for(msg.pattern(), unsynced);
+
+            if (!file)
+                return;
+
+        #ifdef BLOGGER_UNICODE_MODE
+            size_t byte_limit = msg.size() * 2;
+            char* data; BLOGGER_STACK_ALLOC(byte_limit, data);
+
+            auto size = file_sink::narrow(msg, data, byte_limit);
+
+            if (!size)
+                return;
+        #else
+            auto* data = msg.data();
+            auto  size = msg.size();
+        #endif
+
+            file->writer->write(data, size);
+
+            if (m_options.sync_mode == durability::on_error && !(msg.log_level() < level::error))
+            {
+                file->unsynced_error = true;
+                m_unsynced_error = true;
+            }
+        }
+
+        // Done writing for now
+        void commit(std::vector<file_handle>& unsynced)
+        {
+            // Nothing waits in our buffers while the others move on
+            if (m_options.shared)
+            {
+                for (auto& file : m_files)
+                    file.writer->flush();
+            }
+
+            // Handed to the OS now, waited for without the lock
+            if (m_unsynced_error)
+            {
+                for (auto& file : m_files)
+                {
+                    if (file.unsynced_error)
+                        keep_unsynced(file, unsynced);
+                }
+
+                m_unsynced_error = false;
+            }
+
+            // Everything written until it runs shares this one
+            if (m_options.sync_mode == durability::group_commit && !m_sync_pending && !m_files.empty())
+            {
+                m_sync_pending = true;
+                housekeeper::get().after(this, m_options.sync_interval, [this]() { sync(); });
+            }
+        }
+
+        // Runs on the housekeeper, waits for the disk without the lock
+        void sync()
+        {
+            std::vector<file_handle> handles;
+
+            {
+                locker lock(m_access);
+
+                m_sync_pending = false;
+
+                for (auto& file : m_files)
+                {
+                    auto handle = file.writer->sync_handle();
+
+                    if (handle.is_open())
+                        handles.push_back(std::move(handle));
+                }
+            }
+
+            for (auto& handle : handles)
+                handle.sync();
+        }
+
+        void keep_unsynced(open_file& file, std::vector<file_handle>& unsynced)
+        {
+            auto handle = file.writer->sync_handle();
+
+            if (handle.is_open())
+                unsynced.push_back(std::move(handle));
+
+            file.unsynced_error = false;
+        }
+
+        open_file* file_for(const log_pattern& pattern, std::vector<file_handle>& unsynced)
+        {
+            if (m_last && m_last->tag == pattern.tag())
+                return m_last;
+
+            if (!m_supported)
+                return nullptr;
+
+            auto name = file_name(pattern.tag());
+            auto found = m_by_tag.find(name);
+
+            if (found != m_by_tag.end())
+            {
+                // Now the most recently used
+                m_files.splice(m_files.begin(), m_files, found->second);
+                found->second->tag = pattern.tag();
+            }
+            else if (!open(pattern.tag(), name, unsynced))
+                return nullptr;
+
+            m_last = &m_files.front();
+
+            return m_last;
+        }
+
+        file_writer::ptr make_writer()
+        {
+            if (m_options.shared)
+                return std::make_unique<shared_writer>(m_options.atomic_write_size);
+
+            return std::make_unique<buffered_writer>(
+                m_options.buffer_size,
+                m_options.flush_bytes,
+                file_mode::append
+            );
+        }
+
+        bool open(const string& tag, const string& name, std::vector<file_handle>& unsynced)
+        {
+            auto writer = make_writer();
+
+            if (!writer->open(m_directory_path + name))
+                return false;
+
+            if (m_files.size() == m_max_open_files)
+            {
+                // Closing it writes out its buffer, but doesn't sync it
+                if (m_options.sync_mode != durability::none)
+                    keep_unsynced(m_files.back(), unsynced);
+
+                m_by_tag.erase(m_files.back().name);
+                m_files.pop_back();
+            }
+
+            m_files.push_front({ tag, name, std::move(writer), false });
+            m_by_tag[name] = m_files.begin();
+
+            return true;
+        }
+    };
+}
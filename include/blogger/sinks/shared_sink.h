@@ -0,0 +1,37 @@
+#pragma once
+
+#include <memory>
+
+#include "blogger/sinks/sink.h"
+
+namespace bl {
+
+    // Lets several loggers write to the same sink, each one owns a
+    // shared_sink in front of it. The target has to be thread safe
+    // and isn't retagged by the loggers.
+    class shared_sink : public sink
+    {
+    private:
+        std::shared_ptr<sink> m_target;
+    public:
+        explicit shared_sink(std::shared_ptr<sink> target)
+            : m_target(std::move(target))
+        {
+        }
+
+        void write(log_message& msg) override
+        {
+            m_target->write(msg);
+        }
+
+        void write_batch(log_message* const* messages, size_t count) override
+        {
+            m_target->write_batch(messages, count);
+        }
+
+        void flush() override
+        {
+            m_target->flush();
+        }
+    };
+}
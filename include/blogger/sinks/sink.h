@@ -1,6 +1,7 @@
 #pragma once
 
 #include "blogger/loggers/log_message.h"
+#include "blogger/sinks/file_options.h"
 
 namespace bl {
 
@@ -30,11 +31,28 @@ namespace bl {
             in_string directory_path,
             size_t bytes_per_file,
             size_t max_log_files,
-            bool rotate_logs);
+            bool rotate_logs,
+            const file_options& options = file_options());
+
+        static ptr make_binary(in_string path);
+
+        // Shared by every logger that asks for the same directory
+        static ptr make_routing_file(
+            in_string directory_path,
+            size_t max_open_files = 64,
+            const file_options& options = file_options());
 
         virtual void write(log_message& msg) = 0;
         virtual void flush() = 0;
 
+        // Async backends hand over consecutive messages of a logger
+        // together, override to write them out with a single call
+        virtual void write_batch(log_message* const* messages, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i)
+                write(*messages[i]);
+        }
+
         virtual void set_tag(in_string name) {}
 
         virtual ~sink() = default;